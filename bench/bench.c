@@ -0,0 +1,601 @@
+/**
+ * @file:		bench/bench.c
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains microbenchmarks for the
+ * 				shell's hot paths, linked against the shell itself.
+ *
+ * 				bench [-f csv|json] [-t ms] [-F] [workload...]
+ *
+ * 				-f		output format, csv by default
+ * 				-t		minimum measured time per workload
+ * 				-F		launch processes with fork() instead of posix_spawn()
+ *
+ * 				Workloads are selected by name prefix, e.g. "pipeline".
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "psh.h"
+#include "arena.h"
+#include "lexer.h"
+#include "cflow.h"
+#include "command.h"
+#include "jobs.h"
+#include "builtin.h"
+#include "hashtable.h"
+#include "parsecache.h"
+#include "pathcache.h"
+#include "variable.h"
+#include "wildcard.h"
+#include "hashtable_old.h"
+
+/**
+ * @brief	Number of background jobs kept outstanding before reaping
+ */
+#define BENCH_REAP_BATCH 256
+
+/**
+ * @brief	Number of keys in the lookup tables, half of what the old
+ * 			fixed-size table can hold
+ */
+#define BENCH_KEYS 20
+
+/**
+ * @brief	Number of keys live at once while churning a table
+ */
+#define BENCH_CHURN_KEYS 4096
+
+typedef struct {
+	const char *name;
+	void (*func)(long iterations);
+} bench_t;
+
+psh_info_t *shell;
+
+static FILE *g_report;
+static volatile uintptr_t g_sink;
+
+static const char *g_lines[] = {
+	"ls -la /tmp",
+	"grep -n 'foo bar' src/*.c | sort -u | head -20 > out.txt",
+	"echo \"hello world\" $HOME >> log.txt &",
+	"cat < in.txt | tr a-z A-Z | wc -l",
+};
+
+static const char *g_pipeline =
+	"cat < in.txt | grep -v \"#\" | sed 's/a/b/g' | sort | uniq -c > out.txt";
+
+static const char *g_hits[] = { "true", "echo", "cd", "export", "hash", "set" };
+static const char *g_misses[] = { "ls", "grep", "sed", "awk", "make", "gcc" };
+
+static char *g_pipeline_lines[17];
+
+static char g_keys[BENCH_KEYS][16];
+static char g_missing_keys[BENCH_KEYS][16];
+static char g_churn_keys[BENCH_CHURN_KEYS][16];
+static hashtable_t *g_hashtable;
+static old_hashtable_t *g_old_hashtable;
+
+/**
+ * @brief	This routine reads the monotonic clock.
+ *
+ * @return	Time in nanoseconds
+ */
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief	This routine parses synthetic lines without the parse cache.
+ */
+static void bench_parse_line(long iterations)
+{
+	char line[256];
+	size_t count = sizeof(g_lines) / sizeof(g_lines[0]);
+
+	for (long i = 0; i < iterations; i++) {
+		strcpy(line, g_lines[i % count]);
+		job_t *job = command_parse_line(line);
+		g_sink += (uintptr_t)job;
+		job_free(job);
+	}
+}
+
+/**
+ * @brief	This routine parses synthetic lines through the parse cache.
+ */
+static void bench_parse_cached(long iterations)
+{
+	char line[256];
+	size_t count = sizeof(g_lines) / sizeof(g_lines[0]);
+
+	for (long i = 0; i < iterations; i++) {
+		strcpy(line, g_lines[i % count]);
+		job_t *job = command_parse(line);
+		g_sink += (uintptr_t)job;
+		job_free(job);
+	}
+}
+
+/**
+ * @brief	This routine splits a pre-scanned pipeline into its stages.
+ */
+static void bench_cflow_parse(long iterations)
+{
+	arena_t tokens_arena;
+	arena_t arena;
+	token_t *tokens;
+
+	arena_init(&tokens_arena);
+	int count = lexer_scan(&tokens_arena, g_pipeline, &tokens);
+
+	for (long i = 0; i < iterations; i++) {
+		// one arena per line, like a job gets
+		arena_init(&arena);
+
+		int pos = 0;
+		while (pos < count) {
+			process_t *proc;
+			int used = cflow_parse(&arena, g_pipeline, tokens + pos,
+								   count - pos, &proc);
+			if (used < 0) {
+				break;
+			}
+			g_sink += (uintptr_t)proc;
+			// step over the pipe
+			pos += used + 1;
+		}
+
+		arena_release(&arena);
+	}
+
+	arena_release(&tokens_arena);
+}
+
+/**
+ * @brief	This routine looks up names that are builtins.
+ */
+static void bench_builtin_hit(long iterations)
+{
+	size_t count = sizeof(g_hits) / sizeof(g_hits[0]);
+
+	for (long i = 0; i < iterations; i++) {
+		g_sink += (uintptr_t)builtin_lookup(g_hits[i % count]);
+	}
+}
+
+/**
+ * @brief	This routine looks up names that aren't builtins.
+ */
+static void bench_builtin_miss(long iterations)
+{
+	size_t count = sizeof(g_misses) / sizeof(g_misses[0]);
+
+	for (long i = 0; i < iterations; i++) {
+		g_sink += (uintptr_t)builtin_lookup(g_misses[i % count]);
+	}
+}
+
+/**
+ * @brief	This routine looks up keys that are in the table.
+ */
+static void bench_hashtable_hit(long iterations)
+{
+	for (long i = 0; i < iterations; i++) {
+		g_sink += (uintptr_t)hashtable_search(g_hashtable,
+											  g_keys[i % BENCH_KEYS]);
+	}
+}
+
+/**
+ * @brief	This routine looks up keys that aren't in the table.
+ */
+static void bench_hashtable_miss(long iterations)
+{
+	for (long i = 0; i < iterations; i++) {
+		g_sink += (uintptr_t)hashtable_search(g_hashtable,
+											  g_missing_keys[i % BENCH_KEYS]);
+	}
+}
+
+/**
+ * @brief	This routine keeps replacing the oldest of many keys,
+ * 			which makes the table grow and then recycle tombstones.
+ */
+static void bench_hashtable_churn(long iterations)
+{
+	hashtable_t *hashtable = hashtable_create();
+
+	for (long i = 0; i < iterations; i++) {
+		char *key = g_churn_keys[i % BENCH_CHURN_KEYS];
+		if (i >= BENCH_CHURN_KEYS) {
+			hashtable_remove(hashtable, key);
+		}
+		hashtable_insert(hashtable, key, key);
+	}
+
+	hashtable_destroy(hashtable);
+}
+
+/**
+ * @brief	This routine looks up keys that are in the old table.
+ */
+static void bench_hashtable_old_hit(long iterations)
+{
+	for (long i = 0; i < iterations; i++) {
+		g_sink += (uintptr_t)old_hashtable_search(g_old_hashtable,
+												  g_keys[i % BENCH_KEYS]);
+	}
+}
+
+/**
+ * @brief	This routine looks up keys that aren't in the old table.
+ */
+static void bench_hashtable_old_miss(long iterations)
+{
+	for (long i = 0; i < iterations; i++) {
+		g_sink += (uintptr_t)old_hashtable_search(
+			g_old_hashtable, g_missing_keys[i % BENCH_KEYS]);
+	}
+}
+
+/**
+ * @brief	This routine sets an unexported variable and reads it back.
+ */
+static void bench_variable_set(long iterations)
+{
+	for (long i = 0; i < iterations; i++) {
+		var_set("BENCH", g_keys[i % BENCH_KEYS], 0);
+		g_sink += (uintptr_t)var_get("BENCH");
+	}
+
+	var_unset("BENCH");
+}
+
+/**
+ * @brief	This routine changes an exported variable and rebuilds
+ * 			the environment, as the next command launch would.
+ */
+static void bench_variable_environ(long iterations)
+{
+	for (long i = 0; i < iterations; i++) {
+		var_set("BENCH", g_keys[i % BENCH_KEYS], VAR_EXPORT);
+		g_sink += (uintptr_t)var_environ();
+	}
+
+	var_unset("BENCH");
+}
+
+/**
+ * @brief	This routine dispatches an already parsed builtin.
+ */
+static void bench_builtin_dispatch(long iterations)
+{
+	char *argv[] = { "true", NULL };
+	process_t proc;
+
+	memset(&proc, 0, sizeof(proc));
+	proc.argc = 1;
+	proc.argv = argv;
+	proc.type = COMMAND_BUILTIN;
+
+	for (long i = 0; i < iterations; i++) {
+		g_sink += command_builtin(&proc);
+	}
+}
+
+/**
+ * @brief	This routine runs a builtin the way a script line does.
+ */
+static void bench_builtin_line(long iterations)
+{
+	char line[] = "true";
+
+	for (long i = 0; i < iterations; i++) {
+		job_t *job = command_parse(line);
+		job_run(job);
+	}
+}
+
+/**
+ * @brief	This routine runs a pipeline of stages copies of /bin/true
+ * 			in the foreground and waits for it.
+ */
+static void bench_pipeline(int stages, long iterations)
+{
+	for (long i = 0; i < iterations; i++) {
+		job_t *job = command_parse(g_pipeline_lines[stages]);
+		job_run(job);
+	}
+}
+
+static void bench_pipeline_1(long iterations)
+{
+	bench_pipeline(1, iterations);
+}
+
+static void bench_pipeline_4(long iterations)
+{
+	bench_pipeline(4, iterations);
+}
+
+static void bench_pipeline_16(long iterations)
+{
+	bench_pipeline(16, iterations);
+}
+
+/**
+ * @brief	This routine starts batches of background jobs and reaps
+ * 			them once the whole batch is outstanding.
+ */
+static void bench_reap(long iterations)
+{
+	char line[] = "/bin/true &";
+	siginfo_t info;
+
+	while (iterations > 0) {
+		long batch = iterations < BENCH_REAP_BATCH ? iterations
+												   : BENCH_REAP_BATCH;
+
+		for (long i = 0; i < batch; i++) {
+			job_t *job = command_parse(line);
+			job_run(job);
+		}
+
+		while (shell->job_max > 0) {
+			// sleep until a child is ready without reaping it
+			memset(&info, 0, sizeof(info));
+			if (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) < 0) {
+				break;
+			}
+			job_check_zombie();
+		}
+
+		iterations -= batch;
+	}
+}
+
+/**
+ * @brief	This routine starts batches of background jobs and waits
+ * 			for them one at a time, the way "wait -n" does.
+ */
+static void bench_wait_any(long iterations)
+{
+	char line[] = "/bin/true &";
+
+	while (iterations > 0) {
+		long batch = iterations < BENCH_REAP_BATCH ? iterations
+												   : BENCH_REAP_BATCH;
+
+		for (long i = 0; i < batch; i++) {
+			job_t *job = command_parse(line);
+			job_run(job);
+		}
+
+		for (long i = 0; i < batch; i++) {
+			job_wait_jobs(NULL, 0, 1, NULL);
+		}
+
+		iterations -= batch;
+	}
+}
+
+/**
+ * @brief	This routine runs batches of /bin/true through the parallel
+ * 			builtin, one per CPU at a time.
+ */
+static void bench_parallel(long iterations)
+{
+	char line[sizeof("parallel /bin/true :::") + BENCH_REAP_BATCH * 2];
+
+	while (iterations > 0) {
+		long batch = iterations < BENCH_REAP_BATCH ? iterations
+												   : BENCH_REAP_BATCH;
+
+		strcpy(line, "parallel /bin/true :::");
+		for (long i = 0; i < batch; i++) {
+			strcat(line, " x");
+		}
+
+		job_t *job = command_parse(line);
+		job_run(job);
+
+		iterations -= batch;
+	}
+}
+
+static bench_t g_benches[] = {
+	{ "parse_line", bench_parse_line },
+	{ "parse_cached", bench_parse_cached },
+	{ "cflow_parse", bench_cflow_parse },
+	{ "builtin_hit", bench_builtin_hit },
+	{ "builtin_miss", bench_builtin_miss },
+	{ "hashtable_hit", bench_hashtable_hit },
+	{ "hashtable_miss", bench_hashtable_miss },
+	{ "hashtable_churn", bench_hashtable_churn },
+	{ "hashtable_old_hit", bench_hashtable_old_hit },
+	{ "hashtable_old_miss", bench_hashtable_old_miss },
+	{ "variable_set", bench_variable_set },
+	{ "variable_environ", bench_variable_environ },
+	{ "builtin_dispatch", bench_builtin_dispatch },
+	{ "builtin_line", bench_builtin_line },
+	{ "pipeline_1", bench_pipeline_1 },
+	{ "pipeline_4", bench_pipeline_4 },
+	{ "pipeline_16", bench_pipeline_16 },
+	{ "reap_background", bench_reap },
+	{ "wait_any", bench_wait_any },
+	{ "parallel", bench_parallel },
+};
+
+/**
+ * @brief	This routine builds the "/bin/true | ..." pipeline lines.
+ */
+static void bench_init_pipelines(void)
+{
+	for (int stages = 1; stages <= 16; stages++) {
+		char *line = malloc(stages * sizeof(" | /bin/true"));
+		strcpy(line, "/bin/true");
+		for (int i = 1; i < stages; i++) {
+			strcat(line, " | /bin/true");
+		}
+		g_pipeline_lines[stages] = line;
+	}
+}
+
+/**
+ * @brief	This routine fills both hashtables with the same keys.
+ */
+static void bench_init_hashtables(void)
+{
+	g_hashtable = hashtable_create();
+	g_old_hashtable = old_hashtable_create();
+
+	for (int i = 0; i < BENCH_KEYS; i++) {
+		snprintf(g_keys[i], sizeof(g_keys[i]), "command%d", i);
+		snprintf(g_missing_keys[i], sizeof(g_missing_keys[i]), "missing%d", i);
+		hashtable_insert(g_hashtable, g_keys[i], g_keys[i]);
+		old_hashtable_insert(g_old_hashtable, g_keys[i], g_keys[i]);
+	}
+
+	for (int i = 0; i < BENCH_CHURN_KEYS; i++) {
+		snprintf(g_churn_keys[i], sizeof(g_churn_keys[i]), "key%d", i);
+	}
+}
+
+/**
+ * @brief	This routine checks whether a workload was selected.
+ *
+ * @return	1 if it should run. Otherwise, 0.
+ */
+static int bench_selected(const char *name, int argc, char **argv)
+{
+	if (argc == 0) {
+		return 1;
+	}
+
+	for (int i = 0; i < argc; i++) {
+		if (strncmp(name, argv[i], strlen(argv[i])) == 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief	Main entry point
+ */
+int main(int argc, char **argv)
+{
+	int json = 0;
+	uint64_t min_ns = 200 * 1000000ull;
+	int options = OPTION_POSIX_SPAWN;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:t:F")) != -1) {
+		switch (opt) {
+		case 'f':
+			json = strcmp(optarg, "json") == 0;
+			break;
+		case 't':
+			min_ns = strtoull(optarg, NULL, 10) * 1000000ull;
+			break;
+		case 'F':
+			options &= ~OPTION_POSIX_SPAWN;
+			break;
+		default:
+			fprintf(stderr,
+					"usage: %s [-f csv|json] [-t ms] [-F] [workload...]\n",
+					argv[0]);
+			return 2;
+		}
+	}
+
+	// workloads print job notifications, keep them out of the report
+	g_report = fdopen(dup(1), "w");
+	int null_fd = open("/dev/null", O_RDWR);
+	dup2(null_fd, 0);
+	dup2(null_fd, 1);
+	close(null_fd);
+
+	shell = calloc(1, sizeof(psh_info_t));
+	shell->options = options;
+	var_init(environ);
+
+	bench_init_pipelines();
+	bench_init_hashtables();
+
+	if (json) {
+		fprintf(g_report, "[");
+	} else {
+		fprintf(g_report, "workload,iterations,total_ns,ns_per_op,ops_per_sec\n");
+	}
+
+	int first = 1;
+	for (size_t i = 0; i < sizeof(g_benches) / sizeof(g_benches[0]); i++) {
+		bench_t *bench = &g_benches[i];
+		if (!bench_selected(bench->name, argc - optind, argv + optind)) {
+			continue;
+		}
+
+		// double the iterations until a run takes long enough to trust
+		long iterations = 1;
+		uint64_t elapsed;
+		for (;;) {
+			uint64_t start = bench_now();
+			bench->func(iterations);
+			elapsed = bench_now() - start;
+			if (elapsed >= min_ns) {
+				break;
+			}
+			iterations *= 2;
+		}
+
+		double ns_per_op = (double)elapsed / iterations;
+		if (json) {
+			fprintf(g_report,
+					"%s\n  {\"workload\": \"%s\", \"iterations\": %ld, "
+					"\"total_ns\": %llu, \"ns_per_op\": %.1f, "
+					"\"ops_per_sec\": %.0f}",
+					first ? "" : ",", bench->name, iterations,
+					(unsigned long long)elapsed, ns_per_op, 1e9 / ns_per_op);
+		} else {
+			fprintf(g_report, "%s,%ld,%llu,%.1f,%.0f\n", bench->name,
+					iterations, (unsigned long long)elapsed, ns_per_op,
+					1e9 / ns_per_op);
+		}
+		fflush(g_report);
+		first = 0;
+	}
+
+	if (json) {
+		fprintf(g_report, "\n]\n");
+	}
+
+	for (int stages = 1; stages <= 16; stages++) {
+		free(g_pipeline_lines[stages]);
+	}
+
+	hashtable_destroy(g_hashtable);
+	old_hashtable_destroy(g_old_hashtable);
+	job_destroy_all();
+	parsecache_clear();
+	pathcache_clear();
+	var_clear();
+	wildcard_clear();
+	free(shell);
+	fclose(g_report);
+
+	return 0;
+}
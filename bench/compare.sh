@@ -0,0 +1,148 @@
+#!/bin/sh
+#
+# Copyright (c) 2023-2024 Jozef Nagy
+#
+# Use of this source code is governed by an MIT-style
+# license that can be found in the LICENSE file or at
+# https://opensource.org/licenses/MIT.
+#
+# Runs the same script workloads under several shells.
+#
+#	compare.sh [-f csv|json] [-n process-iterations] [-m builtin-iterations]
+#	           [-r repeats] [shell...]
+#
+# Every workload is a script of identical lines. The time of an empty
+# script is subtracted, so ns_per_op excludes shell startup. The best
+# of the repeats is reported.
+#
+
+format=csv
+proc_iterations=500
+builtin_iterations=20000
+repeats=3
+
+while getopts f:n:m:r: opt; do
+	case $opt in
+	f) format=$OPTARG ;;
+	n) proc_iterations=$OPTARG ;;
+	m) builtin_iterations=$OPTARG ;;
+	r) repeats=$OPTARG ;;
+	*) exit 2 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -eq 0 ]; then
+	set -- ./psh
+	for sh in dash bash; do
+		command -v $sh >/dev/null 2>&1 && set -- "$@" $sh
+	done
+fi
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# repeat count line...
+repeat()
+{
+	count=$1
+	shift
+	awk -v n="$count" -v line="$*" 'BEGIN { for (i = 0; i < n; i++) print line }'
+}
+
+pipeline()
+{
+	line=/bin/true
+	i=1
+	while [ $i -lt $1 ]; do
+		line="$line | /bin/true"
+		i=$((i + 1))
+	done
+	echo "$line"
+}
+
+: >"$dir/empty"
+repeat $builtin_iterations true >"$dir/builtin"
+repeat $builtin_iterations "true -a \"b c\" 'd e' f g h >/dev/null" >"$dir/parse"
+repeat $builtin_iterations "[ 1 -lt 2 ]" >"$dir/test"
+repeat $builtin_iterations "printf '%s %d\\n' x 1 >/dev/null" >"$dir/printf"
+repeat $builtin_iterations "false && true || true; true" >"$dir/and_or"
+awk -v n="$builtin_iterations" 'BEGIN {
+	printf "for i in"
+	for (i = 0; i < n; i++) printf " %d", i
+	print "; do true; done"
+}' >"$dir/loop"
+repeat $builtin_iterations "x=\$(echo a)" >"$dir/subst_builtin"
+awk -v n="$builtin_iterations" 'BEGIN {
+	for (i = 0; i < n; i++) print "read x <<EOF\nvalue\nEOF"
+}' >"$dir/heredoc"
+repeat $proc_iterations "$(pipeline 1)" >"$dir/pipeline_1"
+repeat $proc_iterations "$(pipeline 4)" >"$dir/pipeline_4"
+repeat $proc_iterations "$(pipeline 16)" >"$dir/pipeline_16"
+repeat $proc_iterations "x=\$(/bin/echo a)" >"$dir/subst"
+mkdir "$dir/files"
+(cd "$dir/files" && awk 'BEGIN { for (i = 0; i < 10000; i++) print "f" i }' |
+	xargs touch)
+repeat $proc_iterations "true $dir/files/f1* $dir/files/*[0-4]9" >"$dir/glob"
+{
+	repeat $proc_iterations "/bin/true &"
+	echo wait
+} >"$dir/reap_background"
+{
+	repeat $proc_iterations "/bin/true &"
+	repeat $proc_iterations "wait -n"
+} >"$dir/wait_any"
+
+# measure shell script, prints the best wall time in nanoseconds
+measure()
+{
+	best=
+	i=0
+	while [ $i -lt $repeats ]; do
+		start=$(date +%s%N)
+		"$1" "$2" </dev/null >/dev/null 2>&1
+		end=$(date +%s%N)
+		elapsed=$((end - start))
+		if [ -z "$best" ] || [ $elapsed -lt $best ]; then
+			best=$elapsed
+		fi
+		i=$((i + 1))
+	done
+	echo $best
+}
+
+if [ "$format" = json ]; then
+	printf '['
+	separator=
+else
+	echo "shell,workload,iterations,total_ns,ns_per_op"
+fi
+
+for sh in "$@"; do
+	base=$(measure "$sh" "$dir/empty")
+	for workload in builtin parse test printf and_or loop subst_builtin \
+		heredoc pipeline_1 pipeline_4 pipeline_16 subst glob \
+		reap_background wait_any; do
+		case $workload in
+		builtin | parse | test | printf | and_or | loop | subst_builtin | \
+			heredoc)
+			iterations=$builtin_iterations ;;
+		*) iterations=$proc_iterations ;;
+		esac
+
+		total=$(($(measure "$sh" "$dir/$workload") - base))
+		per_op=$((total / iterations))
+
+		if [ "$format" = json ]; then
+			printf '%s\n  {"shell": "%s", "workload": "%s", "iterations": %d, "total_ns": %d, "ns_per_op": %d}' \
+				"$separator" "$sh" $workload $iterations $total $per_op
+			separator=,
+		else
+			echo "$sh,$workload,$iterations,$total,$per_op"
+		fi
+	done
+done
+
+if [ "$format" = json ]; then
+	printf '\n]\n'
+fi
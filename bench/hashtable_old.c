@@ -0,0 +1,173 @@
+/**
+ * @file:		bench/hashtable_old.c
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains the fixed-size hashtable psh
+ * 				used before src/hashtable.c, kept as a baseline
+ * 				for the benchmarks. It never grows; don't fill it.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "hashtable_old.h"
+
+static old_hashtable_entry_t OLD_HASHTABLE_REMOVED_ENTRY = { NULL, NULL };
+
+/**
+ * @brief	This routine hashes a key.
+ * 
+ * @return	Hash
+ */
+static int old_hash(const char *key, const int a, const size_t size)
+{
+	uint64_t hash = 0;
+	const size_t keylen = strlen(key);
+
+	for (size_t i = 0; i < keylen; i++) {
+		hash += (uint64_t)pow(a, keylen - (i + 1)) * key[i];
+		hash = hash % size;
+	}
+
+	return (int)hash;
+}
+
+/**
+ * @brief	This routine will allocate enough memory to store
+ * 			the hashtable and initialize it with NULL values.
+ */
+old_hashtable_t *old_hashtable_create(void)
+{
+	old_hashtable_t *hashtable = malloc(sizeof(*hashtable));
+
+	// 41 is the answer.
+	hashtable->size = 41;
+	hashtable->count = 0;
+	hashtable->entry = calloc(hashtable->size, sizeof(old_hashtable_entry_t *));
+
+	return hashtable;
+}
+
+/**
+ * @brief	This routine removes all entries from a hashtable and
+ * 			free()'s it.
+ */
+void old_hashtable_destroy(old_hashtable_t *hashtable)
+{
+	for (size_t i = 0; i < hashtable->size; i++) {
+		old_hashtable_entry_t *entry = hashtable->entry[i];
+		if (entry != NULL) {
+			free(entry->key);
+			free(entry);
+		}
+	}
+
+	free(hashtable->entry);
+	free(hashtable);
+}
+
+
+/**
+ * @brief	This routine inserts an entry into a hashtable.
+ */
+void old_hashtable_insert(old_hashtable_t *hashtable, const char *key, void *value)
+{
+	old_hashtable_entry_t *entry = old_hashtable_new_entry(key, value);
+	int index = old_hashtable_get_hash(entry->key, hashtable->size, 0);
+	old_hashtable_entry_t *cur = hashtable->entry[index];
+	int i = 1;
+	while (cur != NULL) {
+		if (cur != &OLD_HASHTABLE_REMOVED_ENTRY) {
+			if (strcmp(cur->key, key) == 0) {
+				free(cur->key);
+				free(cur);
+				hashtable->entry[index] = entry;
+				return;
+			}
+			index = old_hashtable_get_hash(entry->key, hashtable->size, i);
+			cur = hashtable->entry[index];
+			i++;
+		}
+	}
+	hashtable->entry[index] = entry;
+	hashtable->count++;
+}
+
+/**
+ * @brief	This routine creates an hashtable entry
+ */
+old_hashtable_entry_t *old_hashtable_new_entry(const char *key, void *value)
+{
+	if (key == NULL || value == NULL) {
+		return NULL;
+	}
+
+	old_hashtable_entry_t *entry = malloc(sizeof(old_hashtable_entry_t));
+	entry->key = strdup(key);
+	entry->value = value;
+
+	return entry;
+}
+
+/**
+ * @brief	This routine removes an entry from a hashtable.
+ */
+void old_hashtable_remove_entry(old_hashtable_t *hashtable, const char *key)
+{
+	int index = old_hashtable_get_hash(key, hashtable->size, 0);
+	old_hashtable_entry_t *entry = hashtable->entry[index];
+	int i = 1;
+	while (entry != NULL) {
+		if (entry != &OLD_HASHTABLE_REMOVED_ENTRY) {
+			if (strcmp(entry->key, key) == 0) {
+				free(entry->key);
+				free(entry);
+				hashtable->entry[index] = &OLD_HASHTABLE_REMOVED_ENTRY;
+			}
+		}
+		index = old_hashtable_get_hash(key, hashtable->size, i);
+		entry = hashtable->entry[index];
+		i++;
+	}
+	hashtable->count--;
+}
+
+/**
+ * @brief	This routine searches for a key in a hashtable.
+ */
+void *old_hashtable_search(old_hashtable_t *hashtable, const char *key)
+{
+	int index = old_hashtable_get_hash(key, hashtable->size, 0);
+	old_hashtable_entry_t *entry = hashtable->entry[index];
+
+	int attempt = 1;
+	while (entry != NULL) {
+		if (entry != &OLD_HASHTABLE_REMOVED_ENTRY) {
+			if (strcmp(entry->key, key) == 0) {
+				return entry->value;
+			}
+			index = old_hashtable_get_hash(key, hashtable->size, attempt);
+			entry = hashtable->entry[index];
+			attempt++;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief	This routine calculates the hash of a key
+ * 			with basic collision mitigation
+ */
+int old_hashtable_get_hash(const char *key, const size_t hashmap_size,
+					   const int att)
+{
+	const int a = old_hash(key, 151, hashmap_size);
+	const int b = old_hash(key, 163, hashmap_size);
+
+	return (a + (att * (b + 1))) % hashmap_size;
+}
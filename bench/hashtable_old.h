@@ -0,0 +1,36 @@
+/**
+ * @file:		bench/hashtable_old.h
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains the fixed-size hashtable psh
+ * 				used before src/hashtable.c, kept as a baseline
+ * 				for the benchmarks. It never grows; don't fill it.
+ */
+
+#ifndef __HASHTABLE_OLD_H_
+#define __HASHTABLE_OLD_H_
+
+#include <stddef.h>
+
+typedef struct {
+	char *key;
+	void *value;
+} old_hashtable_entry_t;
+
+typedef struct {
+	size_t size;
+	size_t count;
+	old_hashtable_entry_t **entry;
+} old_hashtable_t;
+
+old_hashtable_t *old_hashtable_create(void);
+void old_hashtable_destroy(old_hashtable_t *hashtable);
+
+void old_hashtable_insert(old_hashtable_t *hashtable, const char *key, void *value);
+old_hashtable_entry_t *old_hashtable_new_entry(const char *key, void *value);
+void *old_hashtable_search(old_hashtable_t *hashtable, const char *key);
+int old_hashtable_get_hash(const char *key, const size_t hashmap_size,
+					   const int att);
+void old_hashtable_remove_entry(old_hashtable_t *hashtable, const char *key);
+
+#endif // __HASHTABLE_OLD_H_
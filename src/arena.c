@@ -0,0 +1,169 @@
+/**
+ * @file:		src/arena.c
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains a bump allocator whose
+ * 				allocations are all released at once.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+
+/**
+ * @brief	Alignment of every allocation
+ */
+#define ARENA_ALIGN (2 * sizeof(void *))
+
+/**
+ * @brief	This routine allocates a new block able to hold size bytes.
+ */
+static arena_block_t *arena_new_block(size_t size)
+{
+	arena_block_t *block = malloc(sizeof(arena_block_t) + size + ARENA_ALIGN);
+	if (block == NULL) {
+		perror("psh");
+		exit(1);
+	}
+
+	block->next = NULL;
+	block->size = size + ARENA_ALIGN;
+	block->used = 0;
+
+	return block;
+}
+
+/**
+ * @brief	This routine initializes an empty arena.
+ */
+void arena_init(arena_t *arena)
+{
+	arena->head = NULL;
+	arena->last = NULL;
+}
+
+/**
+ * @brief	This routine carves an aligned allocation out of a block.
+ * 
+ * @return	Allocation, or NULL if the block is too full.
+ */
+static void *arena_bump(arena_block_t *block, size_t size)
+{
+	uintptr_t cur = (uintptr_t)(block->data + block->used);
+	size_t pad = -cur & (ARENA_ALIGN - 1);
+
+	if (block->size - block->used < size + pad) {
+		return NULL;
+	}
+
+	void *ptr = block->data + block->used + pad;
+	block->used += pad + size;
+
+	return ptr;
+}
+
+/**
+ * @brief	This routine allocates size bytes from an arena.
+ * 			Allocations larger than a quarter block get a block
+ * 			of their own so the current one isn't wasted.
+ */
+void *arena_alloc(arena_t *arena, size_t size)
+{
+	arena_block_t *block = arena->head;
+	void *ptr;
+
+	if (block != NULL) {
+		ptr = arena_bump(block, size);
+		if (ptr != NULL) {
+			arena->last = ptr;
+			return ptr;
+		}
+
+		if (size > ARENA_BLOCK_SIZE / 4) {
+			arena_block_t *big = arena_new_block(size);
+			big->next = block->next;
+			block->next = big;
+			return arena_bump(big, size);
+		}
+	}
+
+	block = arena_new_block(size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+	block->next = arena->head;
+	arena->head = block;
+
+	ptr = arena_bump(block, size);
+	arena->last = ptr;
+
+	return ptr;
+}
+
+/**
+ * @brief	This routine resizes an allocation. The most recent
+ * 			allocation grows in place whenever its block has room.
+ */
+void *arena_realloc(arena_t *arena, void *ptr, size_t old_size,
+					size_t new_size)
+{
+	if (ptr == NULL) {
+		return arena_alloc(arena, new_size);
+	}
+
+	if (new_size <= old_size) {
+		return ptr;
+	}
+
+	arena_block_t *block = arena->head;
+	if (ptr == arena->last) {
+		size_t offset = (char *)ptr - block->data;
+		if (block->size - offset >= new_size) {
+			block->used = offset + new_size;
+			return ptr;
+		}
+	}
+
+	void *new_ptr = arena_alloc(arena, new_size);
+	memcpy(new_ptr, ptr, old_size);
+
+	return new_ptr;
+}
+
+/**
+ * @brief	This routine copies a string into an arena.
+ */
+char *arena_strdup(arena_t *arena, const char *str)
+{
+	return arena_strndup(arena, str, strlen(str));
+}
+
+/**
+ * @brief	This routine copies at most len characters of a string
+ * 			into an arena and terminates the copy.
+ */
+char *arena_strndup(arena_t *arena, const char *str, size_t len)
+{
+	char *copy = arena_alloc(arena, len + 1);
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+
+	return copy;
+}
+
+/**
+ * @brief	This routine frees every block of an arena at once.
+ */
+void arena_release(arena_t *arena)
+{
+	arena_block_t *block = arena->head;
+
+	while (block != NULL) {
+		arena_block_t *next = block->next;
+		free(block);
+		block = next;
+	}
+
+	arena->head = NULL;
+	arena->last = NULL;
+}
@@ -0,0 +1,39 @@
+/**
+ * @file:		src/arena.h
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains a bump allocator whose
+ * 				allocations are all released at once.
+ */
+
+#ifndef __ARENA_H_
+#define __ARENA_H_
+
+#include <stddef.h>
+
+/**
+ * @brief	Default size of an arena block
+ */
+#define ARENA_BLOCK_SIZE 4096
+
+typedef struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+	char data[];
+} arena_block_t;
+
+typedef struct {
+	arena_block_t *head;
+	void *last;
+} arena_t;
+
+void arena_init(arena_t *arena);
+void *arena_alloc(arena_t *arena, size_t size);
+void *arena_realloc(arena_t *arena, void *ptr, size_t old_size,
+					size_t new_size);
+char *arena_strdup(arena_t *arena, const char *str);
+char *arena_strndup(arena_t *arena, const char *str, size_t len);
+void arena_release(arena_t *arena);
+
+#endif // __ARENA_H_
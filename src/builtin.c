@@ -8,6 +8,9 @@
 
 #include <stddef.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <ctype.h>
 #include <string.h>
 #include <signal.h>
 #include <stdio.h>
@@ -15,192 +18,1887 @@
 
 #include <limits.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
 
 #include "builtin.h"
-#include "hashtable.h"
+#include "builtin_table.h"
+#include "cflow.h"
+#include "command.h"
+#include "pathcache.h"
+#include "parsecache.h"
+#include "variable.h"
 #include "psh.h"
 
-hashtable_t *g_builtin_hashtable;
+/**
+ * @brief	Largest amount of data cat moves per system call
+ */
+#define CAT_CHUNK_SIZE (1 << 30)
+
+/**
+ * @brief	Buffer size of cat's read/write fallback
+ */
+#define CAT_BUFFER_SIZE (128 * 1024)
+
+/**
+ * @brief	Bytes read reads at once from seekable input. What follows
+ * 			the line is given back, so it should fit a typical line
+ * 			without copying much more.
+ */
+#define READ_BLOCK_SIZE 512
+
+/**
+ * @brief	Highest exit status of parallel, which counts failed commands
+ */
+#define PARALLEL_MAX_FAILED 101
+
+/**
+ * @brief	How many -j windows of commands parallel may hold unprinted.
+ * 			Each keeps its output file open, so a slow first command
+ * 			stops new ones from starting instead of piling them up.
+ */
+#define PARALLEL_HOLD_FACTOR 2
+
+/**
+ * @brief	A command started by parallel. Its output is collected in
+ * 			out_fd until every command before it has been printed.
+ */
+typedef struct {
+	char *arg;
+	int out_fd;
+	int job_id;
+	int done;
+	int status;
+} parallel_item_t;
+
+static const struct {
+	const char *name;
+	int flag;
+} g_options[] = {
+	{ "posix_spawn", OPTION_POSIX_SPAWN },
+};
+
+/**
+ * @brief	This routine finds a built-in command by name.
+ *
+ * @return	Built-in command, or NULL if name isn't one.
+ */
+const builtin_t *builtin_lookup(const char *name)
+{
+	uint32_t hash = builtin_hash(name, BUILTIN_HASH_SEED);
+	const builtin_t *builtin = &g_builtin_table[hash & (BUILTIN_TABLE_SIZE - 1)];
+
+	if (builtin->name == NULL || strcmp(builtin->name, name) != 0) {
+		return NULL;
+	}
+
+	return builtin;
+}
+
+/**
+ * @brief	This routine checks if a built-in command is going to read
+ * 			stdin, having no file operands or "-" among them.
+ *
+ * @return	1 if it is. Otherwise, 0.
+ */
+int builtin_reads_stdin(const process_t *proc)
+{
+	if (proc->argc < 1) {
+		return 0;
+	}
+
+	const builtin_t *builtin = builtin_lookup(proc->argv[0]);
+	if (builtin == NULL || !(builtin->flags & BUILTIN_STDIN)) {
+		return 0;
+	}
+
+	if (proc->argc < 2) {
+		return 1;
+	}
+
+	for (int i = 1; i < proc->argc; i++) {
+		if (strcmp(proc->argv[i], "-") == 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief	This routine returns 0.
+ */
+int psh_true(process_t *proc)
+{
+	(void)proc;
+	return 0;
+}
+
+/**
+ * @brief	This routine returns 1.
+ */
+int psh_false(process_t *proc)
+{
+	(void)proc;
+	return 1;
+}
+
+/**
+ * @brief	This routine interprets how a zero-copy loop ended.
+ * 
+ * @return	1 on EOF, 0 if the mechanism is unsupported for these fds
+ * 			and nothing was copied yet, -1 on error.
+ */
+static int cat_result(ssize_t len, int copied)
+{
+	if (len == 0) {
+		return 1;
+	}
+
+	if (!copied && (errno == EINVAL || errno == ENOSYS || errno == EXDEV ||
+					errno == EOPNOTSUPP || errno == EBADF)) {
+		return 0;
+	}
+
+	return -1;
+}
+
+/**
+ * @brief	This routine copies with copy_file_range(), which lets the
+ * 			filesystem share or copy extents without touching userspace.
+ * 
+ * @return	1 when everything was copied, 0 if unsupported, -1 on error.
+ */
+static int cat_copy_range(int in_fd, int out_fd)
+{
+	ssize_t len;
+	int copied = 0;
+
+	while ((len = copy_file_range(in_fd, NULL, out_fd, NULL, CAT_CHUNK_SIZE,
+								  0)) > 0) {
+		copied = 1;
+	}
+
+	return cat_result(len, copied);
+}
+
+/**
+ * @brief	This routine copies a file to any fd with sendfile().
+ * 
+ * @return	1 when everything was copied, 0 if unsupported, -1 on error.
+ */
+static int cat_sendfile(int in_fd, int out_fd)
+{
+	ssize_t len;
+	int copied = 0;
+
+	while ((len = sendfile(out_fd, in_fd, NULL, CAT_CHUNK_SIZE)) > 0) {
+		copied = 1;
+	}
+
+	return cat_result(len, copied);
+}
+
+/**
+ * @brief	This routine moves data through the kernel with splice(),
+ * 			which needs a pipe on at least one side.
+ * 
+ * @return	1 when everything was copied, 0 if unsupported, -1 on error.
+ */
+static int cat_splice(int in_fd, int out_fd)
+{
+	ssize_t len;
+	int copied = 0;
+
+	while ((len = splice(in_fd, NULL, out_fd, NULL, CAT_CHUNK_SIZE,
+						 SPLICE_F_MOVE | SPLICE_F_MORE)) > 0) {
+		copied = 1;
+	}
+
+	return cat_result(len, copied);
+}
+
+/**
+ * @brief	This routine copies with plain read() and write().
+ * 
+ * @return	1 when everything was copied, -1 on error.
+ */
+static int cat_read_write(int in_fd, int out_fd)
+{
+	static char buffer[CAT_BUFFER_SIZE];
+	ssize_t len;
+
+	while ((len = read(in_fd, buffer, sizeof(buffer))) != 0) {
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+
+		char *cur = buffer;
+		while (len > 0) {
+			ssize_t written = write(out_fd, cur, len);
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return -1;
+			}
+			cur += written;
+			len -= written;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * @brief	This routine copies in_fd to out_fd using the cheapest
+ * 			mechanism the two file types allow.
+ * 
+ * @return	0 on success, -1 on error.
+ */
+static int cat_copy(int in_fd, int out_fd)
+{
+	struct stat in_st;
+	struct stat out_st;
+	int ret = 0;
+
+	if (fstat(in_fd, &in_st) < 0 || fstat(out_fd, &out_st) < 0) {
+		return -1;
+	}
+
+	if (S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode)) {
+		ret = cat_copy_range(in_fd, out_fd);
+	}
+	if (ret == 0 && S_ISREG(in_st.st_mode)) {
+		ret = cat_sendfile(in_fd, out_fd);
+	}
+	if (ret == 0 && (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode))) {
+		ret = cat_splice(in_fd, out_fd);
+	}
+	if (ret == 0) {
+		ret = cat_read_write(in_fd, out_fd);
+	}
+
+	return ret < 0 ? -1 : 0;
+}
+
+/**
+ * @brief	This routine checks if in_fd reads the regular file that
+ * 			out_fd writes to, with data left to read. Copying it would
+ * 			never catch up with its own output.
+ *
+ * @return	1 if it does. Otherwise, 0.
+ */
+static int cat_is_output(int in_fd, int out_fd)
+{
+	struct stat in_st;
+	struct stat out_st;
+
+	if (fstat(in_fd, &in_st) < 0 || fstat(out_fd, &out_st) < 0 ||
+		!S_ISREG(out_st.st_mode) || in_st.st_dev != out_st.st_dev ||
+		in_st.st_ino != out_st.st_ino) {
+		return 0;
+	}
+
+	// at the end already, as after > truncated it
+	return lseek(in_fd, 0, SEEK_CUR) < in_st.st_size;
+}
+
+/**
+ * @brief	This routine concatenates files to stdout.
+ * 			"-" or no arguments at all stand for stdin.
+ */
+int psh_cat(process_t *proc)
+{
+	char *stdin_only[] = { "-", NULL };
+	char **files = proc->argc < 2 ? stdin_only : proc->argv + 1;
+	int out_fd = fileno(stdout);
+	int status = 0;
+
+	// anything printed earlier has to come first
+	fflush(stdout);
+
+	for (; *files != NULL; files++) {
+		int in_fd = 0;
+
+		if (strcmp(*files, "-") != 0) {
+			in_fd = open(*files, O_RDONLY | O_CLOEXEC);
+			if (in_fd < 0) {
+				fprintf(stderr, "cat: %s: %s\n", *files, strerror(errno));
+				status = 1;
+				continue;
+			}
+		}
+
+		if (cat_is_output(in_fd, out_fd)) {
+			fprintf(stderr, "cat: %s: input file is output file\n", *files);
+			status = 1;
+		} else if (cat_copy(in_fd, out_fd) < 0) {
+			fprintf(stderr, "cat: %s: %s\n", *files, strerror(errno));
+			status = 1;
+		}
+
+		if (in_fd != 0) {
+			close(in_fd);
+		}
+	}
+
+	return status;
+}
+
+/**
+ * @brief	This routine prints every argument back to stdio.
+ */
+int psh_echo(process_t *proc)
+{
+	for (int i = 1; i < proc->argc; i++) {
+		if (i > 1) {
+			putchar(' ');
+		}
+		fputs(proc->argv[i], stdout);
+	}
+
+	printf("\n");
+	return 0;
+}
+
+/**
+ * @brief	This routine writes the backslash escape at *s to out and
+ * 			advances *s past it. In the argument of %b, octal escapes
+ * 			start with \0 and \c stops all further output.
+ *
+ * @return	1 if output should stop. Otherwise, 0.
+ */
+static int printf_escape(FILE *out, const char **s, int in_arg)
+{
+	static const char escapes[] = "a\ab\bf\fn\nr\rt\tv\v\\\\\"\"";
+	const char *p = *s + 1;
+	const char *escape;
+
+	if (*p == 'c' && in_arg) {
+		*s = p + 1;
+		return 1;
+	}
+
+	if (*p >= '0' && *p <= '7') {
+		int value = 0;
+		int digits = 0;
+
+		// \0NNN in %b, \NNN in the format
+		if (in_arg && *p == '0') {
+			p++;
+		}
+		while (digits < 3 && *p >= '0' && *p <= '7') {
+			value = value * 8 + (*p++ - '0');
+			digits++;
+		}
+		fputc(value, out);
+	} else if (*p != '\0' && (escape = strchr(escapes, *p)) != NULL &&
+			   (escape - escapes) % 2 == 0) {
+		fputc(escape[1], out);
+		p++;
+	} else {
+		// not an escape, print it as it is
+		fputc('\\', out);
+	}
+
+	*s = p;
+	return 0;
+}
+
+/**
+ * @brief	This routine converts a numeric printf argument. A leading
+ * 			quote yields the value of the character after it.
+ *
+ * @return	Value
+ */
+static intmax_t printf_integer(const char *arg, int *status)
+{
+	if (arg == NULL) {
+		return 0;
+	}
+
+	if (arg[0] == '\'' || arg[0] == '"') {
+		return (unsigned char)arg[1];
+	}
+
+	char *end;
+	errno = 0;
+	intmax_t value = strtoimax(arg, &end, 0);
+	if (end == arg || *end != '\0' || errno == ERANGE) {
+		fprintf(stderr, "printf: %s: invalid number\n", arg);
+		*status = 1;
+	}
+
+	return value;
+}
+
+/**
+ * @brief	This routine converts a floating point printf argument.
+ *
+ * @return	Value
+ */
+static double printf_float(const char *arg, int *status)
+{
+	if (arg == NULL) {
+		return 0;
+	}
+
+	if (arg[0] == '\'' || arg[0] == '"') {
+		return (unsigned char)arg[1];
+	}
+
+	char *end;
+	errno = 0;
+	double value = strtod(arg, &end);
+	if (end == arg || *end != '\0' || errno == ERANGE) {
+		fprintf(stderr, "printf: %s: invalid number\n", arg);
+		*status = 1;
+	}
+
+	return value;
+}
+
+/**
+ * @brief	This routine writes formatted output. The format is reused
+ * 			as long as it consumes arguments and some are left.
+ */
+int psh_printf(process_t *proc)
+{
+	if (proc->argc < 2) {
+		fprintf(stderr, "printf: usage: printf format [argument...]\n");
+		return 2;
+	}
+
+	const char *format = proc->argv[1];
+	char **args = proc->argv + 2;
+	int count = proc->argc - 2;
+	int used = 0;
+	int status = 0;
+	int pass_start;
+
+	do {
+		pass_start = used;
+
+		for (const char *f = format; *f != '\0';) {
+			if (*f == '\\') {
+				printf_escape(stdout, &f, 0);
+				continue;
+			}
+
+			if (*f != '%') {
+				putchar(*f++);
+				continue;
+			}
+
+			if (f[1] == '%') {
+				putchar('%');
+				f += 2;
+				continue;
+			}
+
+			// copy flags, width and precision, taking * from the arguments
+			char spec[64];
+			size_t len = 0;
+			spec[len++] = *f++;
+
+			while (*f != '\0' && strchr("-+ #0", *f) && len < 8) {
+				spec[len++] = *f++;
+			}
+			for (int part = 0; part < 2; part++) {
+				if (part == 1) {
+					if (*f != '.') {
+						break;
+					}
+					spec[len++] = *f++;
+				}
+				if (*f == '*') {
+					const char *arg = used < count ? args[used++] : NULL;
+					len += snprintf(spec + len, 16, "%d",
+									(int)printf_integer(arg, &status));
+					f++;
+				} else {
+					while (*f >= '0' && *f <= '9' && len < 40) {
+						spec[len++] = *f++;
+					}
+				}
+			}
+
+			char conv = *f;
+			if (conv == '\0' || !strchr("diouxXeEfFgGaAcsb", conv)) {
+				fprintf(stderr, "printf: %%%c: invalid directive\n", conv);
+				fflush(stdout);
+				return 1;
+			}
+			f++;
+
+			const char *arg = used < count ? args[used++] : NULL;
+
+			switch (conv) {
+			case 'd':
+			case 'i':
+				strcpy(spec + len, "jd");
+				printf(spec, printf_integer(arg, &status));
+				break;
+			case 'o':
+			case 'u':
+			case 'x':
+			case 'X':
+				spec[len++] = 'j';
+				spec[len++] = conv;
+				spec[len] = '\0';
+				printf(spec, (uintmax_t)printf_integer(arg, &status));
+				break;
+			case 'c': {
+				char one[2] = { arg != NULL ? arg[0] : '\0', '\0' };
+				strcpy(spec + len, "s");
+				printf(spec, one);
+				break;
+			}
+			case 's':
+				strcpy(spec + len, "s");
+				printf(spec, arg != NULL ? arg : "");
+				break;
+			case 'b': {
+				// expand into a memory stream so width and precision apply
+				char *expanded = NULL;
+				size_t size = 0;
+				int stop = 0;
+
+				FILE *out = open_memstream(&expanded, &size);
+				if (out == NULL) {
+					perror("printf");
+					return 1;
+				}
+				for (const char *a = arg != NULL ? arg : ""; *a != '\0';) {
+					if (*a == '\\') {
+						if ((stop = printf_escape(out, &a, 1))) {
+							break;
+						}
+					} else {
+						fputc(*a++, out);
+					}
+				}
+				fclose(out);
+
+				strcpy(spec + len, "s");
+				printf(spec, expanded);
+				free(expanded);
+				if (stop) {
+					fflush(stdout);
+					return status;
+				}
+				break;
+			}
+			default:
+				spec[len++] = conv;
+				spec[len] = '\0';
+				printf(spec, printf_float(arg, &status));
+				break;
+			}
+		}
+	} while (used < count && used > pass_start);
+
+	fflush(stdout);
+	return status;
+}
+
+/**
+ * @brief	This routine changes the current working directory to argv[1].
+ * 			If no arguments are present, change to $HOME.
+ */
+int psh_chdir(process_t *proc)
+{
+	if (proc->argc < 2) {
+		const char *home = var_get("HOME");
+		return home ? chdir(home) : 0;
+	}
+
+	return chdir(proc->argv[1]);
+}
+
+typedef struct {
+	char **argv;
+	int pos;
+	int end;
+	int error;
+} test_state_t;
+
+static int test_or(test_state_t *state);
+
+/**
+ * @brief	This routine converts an integer operand of test.
+ *
+ * @return	Value
+ */
+static intmax_t test_integer(test_state_t *state, const char *arg)
+{
+	char *end;
+	errno = 0;
+	intmax_t value = strtoimax(arg, &end, 10);
+
+	while (isspace((unsigned char)*end)) {
+		end++;
+	}
+	if (end == arg || *end != '\0' || errno == ERANGE) {
+		fprintf(stderr, "test: %s: integer expression expected\n", arg);
+		state->error = 1;
+	}
+
+	return value;
+}
+
+/**
+ * @brief	This routine checks if op is a unary primary of test.
+ *
+ * @return	1 if it is. Otherwise, 0.
+ */
+static int test_is_unary(const char *op)
+{
+	return op[0] == '-' && op[1] != '\0' && op[2] == '\0' &&
+		   strchr("bcdefghknprsStuwxzLOG", op[1]) != NULL;
+}
+
+/**
+ * @brief	This routine checks if op is a binary primary of test.
+ *
+ * @return	1 if it is. Otherwise, 0.
+ */
+static int test_is_binary(const char *op)
+{
+	static const char *ops[] = { "=",	"==",  "!=",  "<",	 ">",	"-eq",
+								 "-ne", "-gt", "-ge", "-lt", "-le", "-nt",
+								 "-ot", "-ef", NULL };
+
+	for (int i = 0; ops[i] != NULL; i++) {
+		if (strcmp(op, ops[i]) == 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief	This routine evaluates a unary primary.
+ *
+ * @return	1 if true. Otherwise, 0.
+ */
+static int test_unary(test_state_t *state, const char *op, const char *arg)
+{
+	struct stat st;
+
+	switch (op[1]) {
+	case 'n':
+		return arg[0] != '\0';
+	case 'z':
+		return arg[0] == '\0';
+	case 't':
+		return isatty((int)test_integer(state, arg));
+	case 'h':
+	case 'L':
+		return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+	case 'r':
+		return faccessat(AT_FDCWD, arg, R_OK, AT_EACCESS) == 0;
+	case 'w':
+		return faccessat(AT_FDCWD, arg, W_OK, AT_EACCESS) == 0;
+	case 'x':
+		return faccessat(AT_FDCWD, arg, X_OK, AT_EACCESS) == 0;
+	}
+
+	if (stat(arg, &st) < 0) {
+		return 0;
+	}
+
+	switch (op[1]) {
+	case 'b':
+		return S_ISBLK(st.st_mode);
+	case 'c':
+		return S_ISCHR(st.st_mode);
+	case 'd':
+		return S_ISDIR(st.st_mode);
+	case 'f':
+		return S_ISREG(st.st_mode);
+	case 'g':
+		return (st.st_mode & S_ISGID) != 0;
+	case 'k':
+		return (st.st_mode & S_ISVTX) != 0;
+	case 'p':
+		return S_ISFIFO(st.st_mode);
+	case 's':
+		return st.st_size > 0;
+	case 'S':
+		return S_ISSOCK(st.st_mode);
+	case 'u':
+		return (st.st_mode & S_ISUID) != 0;
+	case 'O':
+		return st.st_uid == geteuid();
+	case 'G':
+		return st.st_gid == getegid();
+	}
+
+	// -e
+	return 1;
+}
+
+/**
+ * @brief	This routine evaluates a binary primary.
+ *
+ * @return	1 if true. Otherwise, 0.
+ */
+static int test_binary(test_state_t *state, const char *left, const char *op,
+					   const char *right)
+{
+	if (op[0] != '-') {
+		int cmp = strcmp(left, right);
+		switch (op[0]) {
+		case '!':
+			return cmp != 0;
+		case '<':
+			return cmp < 0;
+		case '>':
+			return cmp > 0;
+		}
+		return cmp == 0;
+	}
+
+	if (op[1] == 'n' && op[2] == 't') {
+		struct stat l, r;
+		if (stat(left, &l) < 0) {
+			return 0;
+		}
+		return stat(right, &r) < 0 ||
+			   l.st_mtim.tv_sec > r.st_mtim.tv_sec ||
+			   (l.st_mtim.tv_sec == r.st_mtim.tv_sec &&
+				l.st_mtim.tv_nsec > r.st_mtim.tv_nsec);
+	}
+
+	if (op[1] == 'o' && op[2] == 't') {
+		return test_binary(state, right, "-nt", left);
+	}
+
+	if (op[1] == 'e' && op[2] == 'f') {
+		struct stat l, r;
+		return stat(left, &l) == 0 && stat(right, &r) == 0 &&
+			   l.st_dev == r.st_dev && l.st_ino == r.st_ino;
+	}
+
+	intmax_t a = test_integer(state, left);
+	intmax_t b = test_integer(state, right);
+
+	if (strcmp(op, "-eq") == 0) {
+		return a == b;
+	} else if (strcmp(op, "-ne") == 0) {
+		return a != b;
+	} else if (strcmp(op, "-gt") == 0) {
+		return a > b;
+	} else if (strcmp(op, "-ge") == 0) {
+		return a >= b;
+	} else if (strcmp(op, "-lt") == 0) {
+		return a < b;
+	}
+	return a <= b;
+}
+
+/**
+ * @brief	This routine evaluates a primary, or a parenthesized or
+ * 			negated expression.
+ *
+ * @return	1 if true. Otherwise, 0.
+ */
+static int test_primary(test_state_t *state)
+{
+	char **argv = state->argv;
+	int left = state->end - state->pos;
+
+	if (left <= 0) {
+		fprintf(stderr, "test: argument expected\n");
+		state->error = 1;
+		return 0;
+	}
+
+	const char *arg = argv[state->pos];
+
+	// a binary primary wins, so "[ ! = x ]" compares strings
+	if (left >= 3 && test_is_binary(argv[state->pos + 1])) {
+		state->pos += 3;
+		return test_binary(state, arg, argv[state->pos - 2],
+						   argv[state->pos - 1]);
+	}
+
+	if (strcmp(arg, "!") == 0 && left >= 2) {
+		state->pos++;
+		return !test_primary(state);
+	}
+
+	if (strcmp(arg, "(") == 0 && left >= 2) {
+		state->pos++;
+		int result = test_or(state);
+		if (state->pos >= state->end || strcmp(argv[state->pos], ")") != 0) {
+			fprintf(stderr, "test: `)' expected\n");
+			state->error = 1;
+			return 0;
+		}
+		state->pos++;
+		return result;
+	}
+
+	if (test_is_unary(arg) && left >= 2) {
+		state->pos += 2;
+		return test_unary(state, arg, argv[state->pos - 1]);
+	}
+
+	state->pos++;
+	return arg[0] != '\0';
+}
+
+/**
+ * @brief	This routine evaluates primaries joined by -a.
+ *
+ * @return	1 if true. Otherwise, 0.
+ */
+static int test_and(test_state_t *state)
+{
+	int result = test_primary(state);
+
+	while (state->pos < state->end &&
+		   strcmp(state->argv[state->pos], "-a") == 0) {
+		state->pos++;
+		// evaluate anyway, a syntax error must still be noticed
+		result = test_primary(state) && result;
+	}
+
+	return result;
+}
+
+/**
+ * @brief	This routine evaluates expressions joined by -o, which
+ * 			binds more loosely than -a.
+ *
+ * @return	1 if true. Otherwise, 0.
+ */
+static int test_or(test_state_t *state)
+{
+	int result = test_and(state);
+
+	while (state->pos < state->end &&
+		   strcmp(state->argv[state->pos], "-o") == 0) {
+		state->pos++;
+		result = test_and(state) || result;
+	}
+
+	return result;
+}
+
+/**
+ * @brief	This routine evaluates a conditional expression, as test
+ * 			or as "[", which needs a closing "]".
+ *
+ * @return	0 if true, 1 if false, 2 on error.
+ */
+int psh_test(process_t *proc)
+{
+	test_state_t state = { proc->argv, 1, proc->argc, 0 };
+
+	if (strcmp(proc->argv[0], "[") == 0) {
+		if (strcmp(proc->argv[proc->argc - 1], "]") != 0) {
+			fprintf(stderr, "[: missing `]'\n");
+			return 2;
+		}
+		state.end--;
+	}
+
+	int count = state.end - state.pos;
+	int result;
+
+	// POSIX decides by argument count up to four, which keeps
+	// operators usable as plain strings
+	if (count == 0) {
+		return 1;
+	} else if (count == 1) {
+		result = proc->argv[1][0] != '\0';
+		state.pos = state.end;
+	} else if (count == 2 && strcmp(proc->argv[1], "!") == 0) {
+		result = proc->argv[2][0] == '\0';
+		state.pos = state.end;
+	} else if (count == 4 && strcmp(proc->argv[1], "!") == 0 &&
+			   test_is_binary(proc->argv[3])) {
+		state.pos++;
+		result = !test_or(&state);
+	} else {
+		result = test_or(&state);
+	}
+
+	if (!state.error && state.pos < state.end) {
+		fprintf(stderr, "test: %s: unexpected operator\n",
+				proc->argv[state.pos]);
+		state.error = 1;
+	}
+
+	if (state.error) {
+		return 2;
+	}
+
+	return result ? 0 : 1;
+}
+
+/**
+ * @brief	Block read buffer of the read builtin
+ */
+typedef struct {
+	char data[READ_BLOCK_SIZE];
+	ssize_t len;
+	ssize_t pos;
+	int seekable;
+} read_buffer_t;
+
+/**
+ * @brief	This routine gets the next byte of stdin. Seekable input is
+ * 			read a block at a time, anything else a byte at a time so
+ * 			nothing past the line is consumed.
+ *
+ * @return	Byte, or -1 on EOF or error.
+ */
+static int read_byte(read_buffer_t *buffer)
+{
+	if (buffer->pos == buffer->len) {
+		ssize_t len;
+		do {
+			len = read(0, buffer->data,
+					   buffer->seekable ? READ_BLOCK_SIZE : 1);
+		} while (len < 0 && errno == EINTR);
+
+		if (len <= 0) {
+			return -1;
+		}
+		buffer->len = len;
+		buffer->pos = 0;
+	}
+
+	return (unsigned char)buffer->data[buffer->pos++];
+}
+
+/**
+ * @brief	This routine appends a byte to a growing string.
+ */
+static void read_append(char **str, size_t *len, size_t *cap, char c)
+{
+	if (*len + 1 >= *cap) {
+		*cap *= 2;
+		*str = realloc(*str, *cap);
+		if (*str == NULL) {
+			perror("read");
+			exit(1);
+		}
+	}
+
+	(*str)[(*len)++] = c;
+	(*str)[*len] = '\0';
+}
+
+/**
+ * @brief	This routine checks if c is white space that is part of IFS.
+ *
+ * @return	1 if it is. Otherwise, 0.
+ */
+static int read_ifs_space(const char *ifs, char c)
+{
+	return c != '\0' && strchr(" \t\n", c) != NULL && strchr(ifs, c) != NULL;
+}
+
+/**
+ * @brief	This routine reads a line from stdin and splits it into
+ * 			variables at characters of IFS; the last one gets the rest
+ * 			of the line. Unless -r is given, a backslash quotes the next
+ * 			character and a backslash-newline continues the line.
+ *
+ * @return	0 on success, 1 on EOF, 2 on a usage error.
+ */
+int psh_read(process_t *proc)
+{
+	static read_buffer_t buffer;
+	int raw = 0;
+	int first = 1;
+
+	for (; first < proc->argc && proc->argv[first][0] == '-'; first++) {
+		if (strcmp(proc->argv[first], "--") == 0) {
+			first++;
+			break;
+		} else if (strcmp(proc->argv[first], "-r") == 0) {
+			raw = 1;
+		} else {
+			fprintf(stderr, "read: usage: read [-r] [name...]\n");
+			return 2;
+		}
+	}
+
+	buffer.len = 0;
+	buffer.pos = 0;
+	buffer.seekable = lseek(0, 0, SEEK_CUR) >= 0;
+
+	// the line with every quoted byte marked by a leading backslash
+	size_t cap = 128;
+	size_t len = 0;
+	char *line = malloc(cap);
+	int eof = 0;
+	int c;
+
+	if (line == NULL) {
+		perror("read");
+		exit(1);
+	}
+	line[0] = '\0';
+
+	for (;;) {
+		c = read_byte(&buffer);
+		if (c < 0) {
+			eof = 1;
+			break;
+		}
+		if (c == '\n') {
+			break;
+		}
+		if (c == '\\' && !raw) {
+			c = read_byte(&buffer);
+			if (c < 0) {
+				eof = 1;
+				break;
+			}
+			if (c == '\n') {
+				continue;
+			}
+			read_append(&line, &len, &cap, '\\');
+		}
+		read_append(&line, &len, &cap, c);
+	}
+
+	// give back what was read past the line
+	if (buffer.seekable && buffer.pos < buffer.len) {
+		lseek(0, buffer.pos - buffer.len, SEEK_CUR);
+	}
+
+	const char *ifs = var_get("IFS");
+	if (ifs == NULL) {
+		ifs = " \t\n";
+	}
+
+	char *reply[] = { "REPLY", NULL };
+	char **names = first < proc->argc ? proc->argv + first : reply;
+	int count = first < proc->argc ? proc->argc - first : 1;
+	int status = eof ? 1 : 0;
+	char *value = malloc(len + 1);
+	size_t pos = 0;
+
+	if (value == NULL) {
+		perror("read");
+		exit(1);
+	}
+
+	while (pos < len && read_ifs_space(ifs, line[pos])) {
+		pos++;
+	}
+
+	for (int i = 0; i < count; i++) {
+		int last = i == count - 1;
+		size_t out = 0;
+		size_t keep = 0;
+
+		while (pos < len) {
+			c = line[pos];
+			if (c == '\\' && !raw) {
+				value[out++] = line[pos + 1];
+				pos += 2;
+				keep = out;
+				continue;
+			}
+			if (strchr(ifs, c) != NULL && c != '\0') {
+				if (!last) {
+					break;
+				}
+				value[out++] = c;
+				pos++;
+				if (!read_ifs_space(ifs, c)) {
+					keep = out;
+				}
+				continue;
+			}
+			value[out++] = c;
+			pos++;
+			keep = out;
+		}
+		value[last ? keep : out] = '\0';
+
+		// one delimiter, with any IFS white space around it
+		if (!last) {
+			while (pos < len && read_ifs_space(ifs, line[pos])) {
+				pos++;
+			}
+			if (pos < len && strchr(ifs, line[pos]) != NULL) {
+				pos++;
+				while (pos < len && read_ifs_space(ifs, line[pos])) {
+					pos++;
+				}
+			}
+		}
+
+		if (var_set(names[i], value, 0) < 0) {
+			fprintf(stderr, "read: `%s': not a valid identifier\n", names[i]);
+			status = 2;
+		}
+	}
+
+	free(value);
+	free(line);
+	return status;
+}
+
+/**
+ * @brief	This routine checks if path is absolute and free of
+ * 			"." and ".." components.
+ *
+ * @return	1 if it is. Otherwise, 0.
+ */
+static int pwd_is_canonical(const char *path)
+{
+	if (path[0] != '/') {
+		return 0;
+	}
+
+	for (const char *p = path; *p != '\0'; p++) {
+		if (p[0] == '/' && p[1] == '.' &&
+			(p[2] == '/' || p[2] == '\0' ||
+			 (p[2] == '.' && (p[3] == '/' || p[3] == '\0')))) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * @brief	This routine prints the current working directory. With -L,
+ * 			the default, $PWD is trusted as long as it still names it.
+ */
+int psh_pwd(process_t *proc)
+{
+	int physical = 0;
+
+	for (int i = 1; i < proc->argc; i++) {
+		if (strcmp(proc->argv[i], "-P") == 0) {
+			physical = 1;
+		} else if (strcmp(proc->argv[i], "-L") == 0) {
+			physical = 0;
+		} else {
+			fprintf(stderr, "pwd: usage: pwd [-L|-P]\n");
+			return 2;
+		}
+	}
+
+	const char *pwd = var_get("PWD");
+	struct stat pwd_st;
+	struct stat dot_st;
+
+	if (!physical && pwd != NULL && pwd_is_canonical(pwd) &&
+		stat(pwd, &pwd_st) == 0 && stat(".", &dot_st) == 0 &&
+		pwd_st.st_dev == dot_st.st_dev && pwd_st.st_ino == dot_st.st_ino) {
+		printf("%s\n", pwd);
+		return 0;
+	}
+
+	char cwd[PATH_MAX];
+	if (getcwd(cwd, sizeof(cwd)) == NULL) {
+		perror("pwd");
+		return 1;
+	}
+
+	printf("%s\n", cwd);
+	return 0;
+}
+
+/**
+ * @brief	This routine tells how each name would be run.
+ */
+int psh_type(process_t *proc)
+{
+	int status = 0;
+
+	for (int i = 1; i < proc->argc; i++) {
+		const char *name = proc->argv[i];
+		const char *path;
+
+		if (cflow_is_keyword(name)) {
+			printf("%s is a shell keyword\n", name);
+		} else if (builtin_lookup(name) != NULL) {
+			printf("%s is a shell builtin\n", name);
+		} else if ((path = pathcache_lookup(name)) != NULL &&
+				   access(path, X_OK) == 0) {
+			printf("%s is %s\n", name, path);
+		} else {
+			fprintf(stderr, "type: %s: not found\n", name);
+			status = 1;
+		}
+	}
+
+	return status;
+}
+
+/**
+ * @brief	This routine brings PID to foreground
+ */
+int psh_fg(process_t *proc)
+{
+	if (proc->argc < 2) {
+		printf("fg: not enough arguments\n");
+		return -1;
+	}
+
+	pid_t pid;
+	int job_id = -1;
+
+	if (strncmp(proc->argv[1], "%", 1) == 0) {
+		job_id = atoi(proc->argv[1] + 1);
+		pid = job_id_to_pid(job_id);
+		if (pid < 0) {
+			printf("fg: no such job: %s\n", proc->argv[1]);
+			return -1;
+		}
+	} else {
+		pid = atoi(proc->argv[1]);
+	}
+
+	if (kill(-pid, SIGCONT) < 0) {
+		printf("fg: no such PID: %d\n", pid);
+		return -1;
+	}
+
+	tcsetpgrp(0, pid);
+
+	if (job_id > 0) {
+		job_set_proc_status(job_id, STATUS_CONTINUED);
+		job_print_status(job_id);
+		if (job_wait(job_id) >= 0) {
+			job_remove(job_id);
+		}
+	} else {
+		job_wait_pid(pid);
+	}
+
+	signal(SIGTTOU, SIG_IGN);
+	tcsetpgrp(0, getpid());
+	signal(SIGTTOU, SIG_DFL);
+
+	return 0;
+}
 
 /**
- * @brief	This routine creates and fills a hashtable
- * 			with pointers to built-in command functions.
+ * @brief	This routine resolves a job specification: %N, %% or %+
+ * 			for the most recent job, or the PID of one of its processes.
+ *
+ * @return	Job ID, or -1 if no such job exists.
  */
-void builtin_init(void)
+static int builtin_job_id(const char *spec)
 {
-	g_builtin_hashtable = hashtable_create();
+	int id;
 
-	hashtable_insert(g_builtin_hashtable, "true", psh_true);
-	hashtable_insert(g_builtin_hashtable, "false", psh_false);
-	hashtable_insert(g_builtin_hashtable, "echo", psh_echo);
-	hashtable_insert(g_builtin_hashtable, "exit", psh_exit);
-	hashtable_insert(g_builtin_hashtable, "chdir", psh_chdir);
-	hashtable_insert(g_builtin_hashtable, "cat", psh_cat);
-	hashtable_insert(g_builtin_hashtable, "export", psh_export);
-	hashtable_insert(g_builtin_hashtable, "unset", psh_unset);
-	hashtable_insert(g_builtin_hashtable, "fg", psh_fg);
+	if (strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) {
+		id = shell->job_max;
+	} else if (spec[0] == '%') {
+		id = atoi(spec + 1);
+	} else {
+		id = job_pid_to_id(atoi(spec));
+	}
 
-	// aliases
-	hashtable_insert(g_builtin_hashtable, "cd", psh_chdir);
+	return job_get(id) != NULL ? id : -1;
 }
 
 /**
- * @brief	This routine returns 0.
+ * @brief	This routine resumes a stopped job in the background.
  */
-int psh_true(process_t *proc)
+int psh_bg(process_t *proc)
 {
-	(void)proc;
-	return 0;
+	int status = 0;
+
+	if (proc->argc < 2 && builtin_job_id("%%") < 0) {
+		fprintf(stderr, "bg: no current job\n");
+		return 1;
+	}
+
+	for (int i = 1; i < proc->argc || i == 1; i++) {
+		const char *spec = i < proc->argc ? proc->argv[i] : "%%";
+		int id = builtin_job_id(spec);
+		job_t *job = job_get(id);
+		if (job == NULL) {
+			fprintf(stderr, "bg: %s: no such job\n", spec);
+			status = 1;
+			continue;
+		}
+
+		if (kill(-job->pgid, SIGCONT) < 0) {
+			perror("bg");
+			status = 1;
+			continue;
+		}
+
+		process_t *p;
+		for (p = job->root; p != NULL; p = p->next) {
+			if (p->status == STATUS_SUSPENDED) {
+				p->status = STATUS_CONTINUED;
+			}
+		}
+
+		job->mode = BG_EXEC;
+		job_watch(job);
+		printf("[%d] %s &\n", id, job->cmd);
+	}
+
+	return status;
 }
 
 /**
- * @brief	This routine returns 1.
+ * @brief	This routine lists every job, reporting finished ones first.
  */
-int psh_false(process_t *proc)
+int psh_jobs(process_t *proc)
 {
 	(void)proc;
-	return 1;
+
+	job_check_zombie();
+
+	for (int id = 1; id <= shell->job_max; id++) {
+		if (job_get(id) != NULL) {
+			job_print_status(id);
+		}
+	}
+
+	return 0;
 }
 
 /**
- * @brief	This routines opens and prints the contents of a file from argv[1].
+ * @brief	This routine waits for jobs to finish.
+ *
+ * 			wait			every job
+ * 			wait spec...	the given jobs, one after another
+ * 			wait -n			the first job to finish
+ * 			wait -n spec...	the first of the given jobs to finish
+ *
+ * @return	Exit code of the last job waited for, 127 if there was none.
  */
-int psh_cat(process_t *proc)
+int psh_wait(process_t *proc)
 {
-	if (proc->argc < 2) {
-		// @todo: fix this
-		printf("cat: error: file not specified\n");
-		return 1;
+	int any = 0;
+	int first = 1;
+
+	if (proc->argc > 1 && strcmp(proc->argv[1], "-n") == 0) {
+		any = 1;
+		first = 2;
+	}
+
+	// stdio isn't touched while sleeping, let earlier output through
+	fflush(stdout);
+
+	if (first == proc->argc) {
+		int status = job_wait_jobs(NULL, 0, any, NULL);
+		return any ? status : 0;
 	}
 
-	char file_buffer;
-	FILE *file_ptr = fopen(proc->argv[1], "rb");
-	if (file_ptr == NULL) {
-		perror("psh");
-		return errno;
+	int *ids = malloc((proc->argc - first) * sizeof(int));
+	int count = 0;
+	int status = 127;
+
+	if (ids == NULL) {
+		perror("wait");
+		exit(1);
 	}
 
-	file_buffer = fgetc(file_ptr);
-	while (file_buffer != EOF) {
-		printf("%c", file_buffer);
-		file_buffer = fgetc(file_ptr);
+	for (int i = first; i < proc->argc; i++) {
+		int id = builtin_job_id(proc->argv[i]);
+		if (id < 0) {
+			fprintf(stderr, "wait: %s: no such job\n", proc->argv[i]);
+			continue;
+		}
+		ids[count++] = id;
 	}
 
-	fclose(file_ptr);
+	if (any) {
+		if (count > 0) {
+			status = job_wait_jobs(ids, count, 1, NULL);
+		}
+	} else {
+		for (int i = 0; i < count; i++) {
+			status = job_wait_jobs(&ids[i], 1, 0, NULL);
+		}
+	}
 
-	return 0;
+	free(ids);
+	return status;
 }
 
 /**
- * @brief	This routine prints every argument back to stdio.
+ * @brief	This routine quotes a word so the parser reads it back
+ * 			unchanged, appending it to line.
  */
-int psh_echo(process_t *proc)
+static void parallel_quote(char **line, size_t *len, size_t *cap,
+						   const char *word)
 {
-	if (proc->argc < 2) {
-		char *output = NULL;
-		size_t length = 0;
-		getline(&output, &length, stdin);
-		printf("%s ", output);
-		return 0;
+	size_t need = *len + strlen(word) * 4 + 3;
+	if (need > *cap) {
+		*cap = need * 2;
+		*line = realloc(*line, *cap);
+		if (*line == NULL) {
+			perror("parallel");
+			exit(1);
+		}
 	}
-	for (int i = 1; i < proc->argc; i++) {
-		if (strncmp(proc->argv[i], "$", 1) == 0) {
-			memmove(proc->argv[i], proc->argv[i] + 1, strlen(proc->argv[i]));
-			printf("%s ", getenv(proc->argv[i]));
-			continue;
+
+	char *dst = *line + *len;
+	*dst++ = '\'';
+	for (; *word != '\0'; word++) {
+		if (*word == '\'') {
+			memcpy(dst, "'\\''", 4);
+			dst += 4;
+		} else {
+			*dst++ = *word;
 		}
-		printf("%s ", proc->argv[i]);
 	}
+	*dst++ = '\'';
+	*dst = '\0';
+	*len = dst - *line;
+}
 
-	printf("\n");
-	return 0;
+/**
+ * @brief	This routine appends n characters of text to line.
+ */
+static void parallel_append(char **line, size_t *len, size_t *cap,
+							const char *text, size_t n)
+{
+	if (*len + n + 1 > *cap) {
+		*cap = (*len + n + 1) * 2;
+		*line = realloc(*line, *cap);
+		if (*line == NULL) {
+			perror("parallel");
+			exit(1);
+		}
+	}
+
+	memcpy(*line + *len, text, n);
+	*len += n;
+	(*line)[*len] = '\0';
 }
 
 /**
- * @brief	This routine changes the current working directory to argv[1].
- * 			If no arguments are present, change to $HOME.
+ * @brief	This routine builds the command line of one argument:
+ * 			the template with every {} replaced by the argument, or
+ * 			with the argument appended if it has no {}. Every word is
+ * 			quoted, so it reaches the command as it was given.
+ *
+ * @return	Command line, to be free()'d by the caller
  */
-int psh_chdir(process_t *proc)
+static char *parallel_line(char **words, int count, const char *arg)
 {
-	if (proc->argc < 2) {
-		return chdir(getenv("HOME"));
+	char *line = NULL;
+	size_t len = 0;
+	size_t cap = 0;
+	char *word = NULL;
+	size_t word_len = 0;
+	size_t word_cap = 0;
+	int replaced = 0;
+
+	parallel_append(&line, &len, &cap, "", 0);
+
+	for (int i = 0; i < count; i++) {
+		const char *text = words[i];
+		const char *brace;
+
+		word_len = 0;
+		parallel_append(&word, &word_len, &word_cap, "", 0);
+		while ((brace = strstr(text, "{}")) != NULL) {
+			parallel_append(&word, &word_len, &word_cap, text, brace - text);
+			parallel_append(&word, &word_len, &word_cap, arg, strlen(arg));
+			text = brace + 2;
+			replaced = 1;
+		}
+		parallel_append(&word, &word_len, &word_cap, text, strlen(text));
+
+		if (i > 0) {
+			parallel_append(&line, &len, &cap, " ", 1);
+		}
+		parallel_quote(&line, &len, &cap, word);
 	}
+	free(word);
 
-	return chdir(proc->argv[1]);
+	if (!replaced) {
+		parallel_append(&line, &len, &cap, " ", 1);
+		parallel_quote(&line, &len, &cap, arg);
+	}
+
+	return line;
 }
 
 /**
- * @brief	This routine brings PID to foreground
+ * @brief	This routine starts the command of an item in the background,
+ * 			with its stdout going to a memory file.
  */
-int psh_fg(process_t *proc)
+static void parallel_start(parallel_item_t *item, char **words, int count,
+						   int null_stdin)
 {
-	if (proc->argc < 2) {
-		printf("fg: not enough arguments\n");
-		return -1;
+	char *line = parallel_line(words, count, item->arg);
+	job_t *job = command_parse_line(line);
+	free(line);
+
+	item->job_id = -1;
+	item->out_fd = -1;
+	if (job == NULL) {
+		item->done = 1;
+		item->status = 2;
+		return;
 	}
 
-	pid_t pid;
-	int job_id = -1;
+	job->mode = ASYNC_EXEC;
 
-	if (strncmp(proc->argv[1], "%", 1) == 0) {
-		job_id = atoi(proc->argv[1] + 1);
-		pid = job_id_to_pid(job_id);
-		if (pid < 0) {
-			printf("fg: no such job: %s\n", proc->argv[1]);
-			return -1;
+	// without a memory file the output can't be held back, so it
+	// goes straight to stdout
+	item->out_fd = memfd_create("parallel", MFD_CLOEXEC);
+
+	fflush(stdout);
+	int saved_stdout = fcntl(1, F_DUPFD_CLOEXEC, 0);
+	int saved_stdin = fcntl(0, F_DUPFD_CLOEXEC, 0);
+
+	if (item->out_fd >= 0) {
+		dup2(item->out_fd, 1);
+	}
+
+	// arguments are still being read from stdin
+	if (null_stdin) {
+		int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+		if (null_fd >= 0) {
+			dup2(null_fd, 0);
+			close(null_fd);
 		}
+	}
+
+	// job_run() may be done with the job by the time it returns
+	job->refs++;
+	job_run(job);
+
+	if (job_get(job->id) == job) {
+		item->job_id = job->id;
 	} else {
-		pid = atoi(proc->argv[1]);
+		item->done = 1;
+		item->status = 1;
 	}
+	job_free(job);
 
-	if (kill(-pid, SIGCONT) < 0) {
-		printf("fg: no such PID: %d\n", pid);
-		return -1;
+	dup2(saved_stdout, 1);
+	close(saved_stdout);
+	dup2(saved_stdin, 0);
+	close(saved_stdin);
+}
+
+/**
+ * @brief	This routine prints the output of a finished item and
+ * 			reports its exit status if the command failed.
+ */
+static void parallel_finish(parallel_item_t *item)
+{
+	if (item->out_fd >= 0) {
+		lseek(item->out_fd, 0, SEEK_SET);
+		if (cat_copy(item->out_fd, 1) < 0) {
+			perror("parallel");
+		}
+		close(item->out_fd);
 	}
 
-	tcsetpgrp(0, pid);
+	if (item->status != 0) {
+		fprintf(stderr, "parallel: %s: exit %d\n", item->arg, item->status);
+	}
 
-	if (job_id > 0) {
-		job_set_proc_status(job_id, STATUS_CONTINUED);
-		job_print_status(job_id);
-		if (job_wait(job_id) >= 0) {
-			job_remove(job_id);
+	free(item->arg);
+	item->arg = NULL;
+}
+
+/**
+ * @brief	This routine runs a command once per argument, at most
+ * 			-j of them at a time (one per CPU by default).
+ *
+ * 			parallel [-j N] command... ::: argument...
+ * 			parallel [-j N] command...				(arguments from stdin)
+ *
+ * 			{} in the command is replaced by the argument, which is
+ * 			otherwise appended. Output is printed in argument order.
+ *
+ * @return	Number of commands that failed, at most PARALLEL_MAX_FAILED
+ */
+int psh_parallel(process_t *proc)
+{
+	long slots = sysconf(_SC_NPROCESSORS_ONLN);
+	int first = 1;
+
+	if (first < proc->argc && strncmp(proc->argv[first], "-j", 2) == 0) {
+		const char *value = proc->argv[first] + 2;
+		if (*value == '\0' && ++first < proc->argc) {
+			value = proc->argv[first];
 		}
-	} else {
-		job_wait_pid(pid);
+		char *end;
+		slots = strtol(value, &end, 10);
+		if (*value == '\0' || *end != '\0' || slots <= 0) {
+			fprintf(stderr, "parallel: invalid job count\n");
+			return 2;
+		}
+		first++;
 	}
 
-	signal(SIGTTOU, SIG_IGN);
-	tcsetpgrp(0, getpid());
-	signal(SIGTTOU, SIG_DFL);
+	if (slots <= 0) {
+		slots = 1;
+	}
 
-	return 0;
+	int sep = first;
+	while (sep < proc->argc && strcmp(proc->argv[sep], ":::") != 0) {
+		sep++;
+	}
+
+	if (sep == first) {
+		fprintf(stderr, "usage: parallel [-j N] command... [::: argument...]\n");
+		return 2;
+	}
+
+	int from_stdin = sep == proc->argc;
+	int next_arg = sep + 1;
+	char *input = NULL;
+	size_t input_size = 0;
+
+	parallel_item_t *items = NULL;
+	size_t capacity = 0;
+	size_t count = 0;
+	size_t printed = 0;
+
+	int *running = malloc(slots * sizeof(int));
+	size_t *owner = malloc(slots * sizeof(size_t));
+	int active = 0;
+	int failed = 0;
+	int more = 1;
+
+	if (running == NULL || owner == NULL) {
+		perror("parallel");
+		exit(1);
+	}
+
+	fflush(stdout);
+
+	for (;;) {
+		while (more && active < slots
+			   && count - printed < (size_t)slots * PARALLEL_HOLD_FACTOR) {
+			char *arg = NULL;
+
+			if (!from_stdin) {
+				if (next_arg < proc->argc) {
+					arg = strdup(proc->argv[next_arg++]);
+				}
+			} else {
+				ssize_t len = getline(&input, &input_size, stdin);
+				if (len >= 0) {
+					if (len > 0 && input[len - 1] == '\n') {
+						input[len - 1] = '\0';
+					}
+					arg = strdup(input);
+				}
+			}
+
+			if (arg == NULL) {
+				more = 0;
+				break;
+			}
+
+			if (count == capacity) {
+				capacity = capacity ? capacity * 2 : 64;
+				items = realloc(items, capacity * sizeof(parallel_item_t));
+				if (items == NULL) {
+					perror("parallel");
+					exit(1);
+				}
+			}
+
+			parallel_item_t *item = &items[count];
+			item->arg = arg;
+			item->done = 0;
+			item->status = 0;
+			parallel_start(item, proc->argv + first, sep - first, from_stdin);
+
+			if (!item->done) {
+				running[active] = item->job_id;
+				owner[active] = count;
+				active++;
+			}
+			count++;
+		}
+
+		if (active > 0) {
+			int id;
+			int status = job_wait_jobs(running, active, 1, &id);
+
+			for (int i = 0; i < active; i++) {
+				if (running[i] == id) {
+					items[owner[i]].done = 1;
+					items[owner[i]].status = status;
+					active--;
+					running[i] = running[active];
+					owner[i] = owner[active];
+					break;
+				}
+			}
+		}
+
+		for (; printed < count && items[printed].done; printed++) {
+			if (items[printed].status != 0) {
+				failed++;
+			}
+			parallel_finish(&items[printed]);
+		}
+
+		if (!more && active == 0 && printed == count) {
+			break;
+		}
+	}
+
+	if (from_stdin) {
+		clearerr(stdin);
+	}
+
+	free(input);
+	free(items);
+	free(running);
+	free(owner);
+
+	return failed < PARALLEL_MAX_FAILED ? failed : PARALLEL_MAX_FAILED;
 }
 
 /**
- * @brief	This routine sets an envirnoment variable
+ * @brief	This routine exports variables, assigning NAME=value
+ * 			arguments first. Without arguments, it lists them.
  */
 int psh_export(process_t *proc)
 {
 	if (proc->argc < 2) {
-		printf("export: not enough arguments\n");
-		return -1;
+		var_print(VAR_EXPORT);
+		return 0;
+	}
+
+	int status = 0;
+	for (int i = 1; i < proc->argc; i++) {
+		int ret;
+		if (strchr(proc->argv[i], '=') != NULL) {
+			ret = var_assign(proc->argv[i], VAR_EXPORT);
+		} else {
+			ret = var_export(proc->argv[i]);
+		}
+
+		if (ret < 0) {
+			fprintf(stderr, "export: `%s': not a valid identifier\n",
+					proc->argv[i]);
+			status = 1;
+		}
 	}
 
-	return putenv(proc->argv[1]);
+	return status;
 }
 
 /**
- * @brief	This routine removes an envirnoment variable
+ * @brief	This routine removes variables.
  */
 int psh_unset(process_t *proc)
+{
+	int status = 0;
+	for (int i = 1; i < proc->argc; i++) {
+		if (var_unset(proc->argv[i]) < 0) {
+			fprintf(stderr, "unset: `%s': not a valid identifier\n",
+					proc->argv[i]);
+			status = 1;
+		}
+	}
+
+	return status;
+}
+
+/**
+ * @brief	This routine manages the resolved command path cache.
+ * 			Without arguments, list every cached entry. "-r" forgets
+ * 			all entries as well as cached parses, "-s" prints parse
+ * 			cache statistics, any other argument is looked up and cached.
+ */
+int psh_hash(process_t *proc)
 {
 	if (proc->argc < 2) {
-		printf("unset: not enough arguments\n");
-		return -1;
+		pathcache_print();
+		return 0;
+	}
+
+	if (strcmp(proc->argv[1], "-r") == 0) {
+		pathcache_clear();
+		parsecache_clear();
+		return 0;
+	}
+
+	if (strcmp(proc->argv[1], "-s") == 0) {
+		parsecache_print_stats();
+		return 0;
+	}
+
+	int status = 0;
+	for (int i = 1; i < proc->argc; i++) {
+		if (pathcache_add(proc->argv[i]) < 0) {
+			fprintf(stderr, "hash: %s: not found\n", proc->argv[i]);
+			status = 1;
+		}
+	}
+
+	return status;
+}
+
+/**
+ * @brief	This routine leaves or resumes the n innermost loops,
+ * 			for break and continue.
+ */
+static int builtin_loop_control(process_t *proc, int resume)
+{
+	long levels = 1;
+
+	if (proc->argc > 1) {
+		char *end;
+		levels = strtol(proc->argv[1], &end, 10);
+		if (end == proc->argv[1] || *end != '\0' || levels < 1) {
+			fprintf(stderr, "%s: %s: loop count out of range\n",
+					proc->argv[0], proc->argv[1]);
+			return 1;
+		}
+	}
+
+	if (cflow_loop_control(levels > INT_MAX ? INT_MAX : (int)levels,
+						   resume) < 0) {
+		fprintf(stderr, "%s: only meaningful in a loop\n", proc->argv[0]);
 	}
 
-	return unsetenv(proc->argv[1]);
+	return 0;
+}
+
+/**
+ * @brief	This routine leaves the innermost loop, or the n
+ * 			innermost ones.
+ */
+int psh_break(process_t *proc)
+{
+	return builtin_loop_control(proc, 0);
+}
+
+/**
+ * @brief	This routine goes on with the next iteration of the
+ * 			innermost loop, or of the n-th one.
+ */
+int psh_continue(process_t *proc)
+{
+	return builtin_loop_control(proc, 1);
 }
 
 /**
@@ -216,3 +1914,41 @@ int psh_exit(process_t *proc)
 
 	exit(code);
 }
+
+/**
+ * @brief	This routine toggles shell options.
+ * 			"set -o" lists them, "set -o name" enables and
+ * 			"set +o name" disables an option.
+ */
+int psh_set(process_t *proc)
+{
+	const size_t count = sizeof(g_options) / sizeof(g_options[0]);
+
+	if (proc->argc < 3) {
+		for (size_t i = 0; i < count; i++) {
+			printf("%-16s%s\n", g_options[i].name,
+				   (shell->options & g_options[i].flag) ? "on" : "off");
+		}
+		return 0;
+	}
+
+	int enable = strcmp(proc->argv[1], "-o") == 0;
+	if (!enable && strcmp(proc->argv[1], "+o") != 0) {
+		fprintf(stderr, "set: usage: set [-o|+o] [option]\n");
+		return 2;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (strcmp(proc->argv[2], g_options[i].name) == 0) {
+			if (enable) {
+				shell->options |= g_options[i].flag;
+			} else {
+				shell->options &= ~g_options[i].flag;
+			}
+			return 0;
+		}
+	}
+
+	fprintf(stderr, "set: %s: invalid option name\n", proc->argv[2]);
+	return 1;
+}
@@ -9,23 +9,69 @@
 #ifndef __BUILTIN_H_
 #define __BUILTIN_H_
 
+#include <stdint.h>
+
 #include "psh.h"
 
 #define NOT_IMPLEMENTED() \
 	printf("%s has not been implemented yet.\n", __func__);
 
+/**
+ * @brief	Builtin flags
+ */
+#define BUILTIN_PURE (1 << 0)
+#define BUILTIN_STDIN (1 << 1)
+
 typedef int (*builtin_func)(process_t *);
 
-void builtin_init(void);
+typedef struct {
+	const char *name;
+	builtin_func func;
+	int flags;
+} builtin_t;
+
+/**
+ * @brief	This routine hashes a command name for the builtin table.
+ * 			tools/mkbuiltin picks the seed that makes it collision-free.
+ *
+ * @return	Hash
+ */
+static inline uint32_t builtin_hash(const char *name, uint32_t seed)
+{
+	uint32_t hash = seed;
+
+	while (*name != '\0') {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619u;
+	}
+
+	return hash ^ (hash >> 16);
+}
+
+const builtin_t *builtin_lookup(const char *name);
+int builtin_reads_stdin(const process_t *proc);
 
 int psh_true(process_t *proc);
 int psh_false(process_t *proc);
 int psh_cat(process_t *proc);
 int psh_echo(process_t *proc);
+int psh_printf(process_t *proc);
+int psh_test(process_t *proc);
+int psh_read(process_t *proc);
+int psh_pwd(process_t *proc);
+int psh_type(process_t *proc);
 int psh_chdir(process_t *proc);
 int psh_fg(process_t *proc);
+int psh_bg(process_t *proc);
+int psh_jobs(process_t *proc);
+int psh_wait(process_t *proc);
+int psh_parallel(process_t *proc);
 int psh_export(process_t *proc);
 int psh_unset(process_t *proc);
+int psh_hash(process_t *proc);
+int psh_set(process_t *proc);
 int psh_exit(process_t *proc);
+int psh_break(process_t *proc);
+int psh_continue(process_t *proc);
 
 #endif // __BUILTIN_H_
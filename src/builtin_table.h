@@ -0,0 +1,42 @@
+/**
+ * @file:		src/builtin_table.h
+ * @brief:		This file is generated by tools/mkbuiltin from
+ * 				src/builtin.def. Do not edit.
+ */
+
+#ifndef __BUILTIN_TABLE_H_
+#define __BUILTIN_TABLE_H_
+
+#include "builtin.h"
+
+#define BUILTIN_HASH_SEED 168153u
+#define BUILTIN_TABLE_SIZE 32
+
+static const builtin_t g_builtin_table[BUILTIN_TABLE_SIZE] = {
+	[0] = { "wait", psh_wait, 0 },
+	[3] = { "break", psh_break, 0 },
+	[4] = { "pwd", psh_pwd, BUILTIN_PURE },
+	[5] = { "set", psh_set, 0 },
+	[6] = { "parallel", psh_parallel, 0 },
+	[7] = { "cd", psh_chdir, 0 },
+	[8] = { "export", psh_export, 0 },
+	[9] = { "bg", psh_bg, 0 },
+	[11] = { "cat", psh_cat, BUILTIN_STDIN },
+	[12] = { "true", psh_true, BUILTIN_PURE },
+	[15] = { "[", psh_test, BUILTIN_PURE },
+	[16] = { "continue", psh_continue, 0 },
+	[17] = { "exit", psh_exit, 0 },
+	[18] = { "chdir", psh_chdir, 0 },
+	[19] = { "false", psh_false, BUILTIN_PURE },
+	[20] = { "jobs", psh_jobs, 0 },
+	[21] = { "echo", psh_echo, BUILTIN_PURE },
+	[23] = { "printf", psh_printf, BUILTIN_PURE },
+	[24] = { "fg", psh_fg, 0 },
+	[25] = { "type", psh_type, BUILTIN_PURE },
+	[28] = { "read", psh_read, 0 },
+	[29] = { "unset", psh_unset, 0 },
+	[30] = { "test", psh_test, BUILTIN_PURE },
+	[31] = { "hash", psh_hash, 0 },
+};
+
+#endif // __BUILTIN_TABLE_H_
@@ -6,115 +6,1799 @@
  * 				to manage control flow.
  */
 
-#include <glob.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "psh.h"
+#include "builtin.h"
 #include "cflow.h"
 #include "command.h"
+#include "lexer.h"
+#include "variable.h"
+#include "wildcard.h"
 
 /**
- * @brief	This routine creates a new process structure.
+ * @brief	This routine checks if a stage expands to the same
+ * 			argv every time it runs.
  */
-process_t *cflow_parse(char *segment)
+static int cflow_is_static(process_t *proc)
 {
-	int buffer_size = PSH_COMMAND_BUFSIZE;
-	int pos = 0;
-	char *cmd = strdup(segment);
-	char *token;
-	char **token_arr = (char **)malloc(buffer_size * sizeof(char *));
+	const int dynamic = TOKEN_GLOB | TOKEN_VAR | TOKEN_SUBST | TOKEN_PSUBST;
+
+	for (int i = 0; i < proc->nwords; i++) {
+		if (proc->words[i].flags & dynamic) {
+			return 0;
+		}
+	}
+
+	if (proc->in_word != NULL && (proc->in_word->flags & dynamic)) {
+		return 0;
+	}
+	if (proc->out_word != NULL && (proc->out_word->flags & dynamic)) {
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * @brief	This routine expands, once and for all, the stages of a job
+ * 			template that need no expansion at run time. The others
+ * 			are expanded again on every run.
+ */
+void cflow_expand_static(job_t *job)
+{
+	process_t *proc;
+	for (proc = job->root; proc != NULL; proc = proc->next) {
+		if (proc->argv == NULL && cflow_is_static(proc)) {
+			cflow_expand(&job->arena, proc);
+		}
+	}
+}
+
+/**
+ * @brief	This routine checks if a token is a redirection operator.
+ */
+static int cflow_is_redirect(int type)
+{
+	return type == TOKEN_LESS || type == TOKEN_GREAT ||
+		   type == TOKEN_DGREAT || type == TOKEN_DLESS ||
+		   type == TOKEN_DLESSDASH || type == TOKEN_TLESS;
+}
+
+/**
+ * @brief	This routine points stdin or stdout of a process at the
+ * 			target of a redirection operator.
+ */
+static void cflow_redirect(process_t *proc, const token_t *op,
+						   token_t *target)
+{
+	if (op->type == TOKEN_GREAT || op->type == TOKEN_DGREAT) {
+		proc->out_word = target;
+		proc->out_append = op->type == TOKEN_DGREAT;
+	} else {
+		proc->in_word = target;
+		proc->in_here = op->type == TOKEN_LESS ? 0 : op->type;
+	}
+}
+
+/**
+ * @brief	Reserved words. They are only recognized unquoted,
+ * 			where a command may start.
+ */
+static const char *g_keywords[] = {
+	"if",	"then", "elif", "else", "fi",	"while", "until", "for",
+	"in",	"do",	"done", "case", "esac", "time",	 NULL,
+};
+
+/**
+ * @brief	Reserved words that start a compound command
+ */
+static const char *g_openers[] = { "if", "while", "until", "for", "case",
+								   NULL };
+
+/**
+ * @brief	Reserved words that end a compound list
+ */
+static const char *g_terminators[] = { "then", "elif", "else", "fi", "do",
+									   "done", "esac", NULL };
+
+/**
+ * @brief	Loops running now, how many of them break or continue
+ * 			still has to leave, and whether the last one left
+ * 			resumes. interrupted aborts every list up to the
+ * 			outermost one, which lists counts down to.
+ */
+static int g_cflow_loops = 0;
+static int g_cflow_skip = 0;
+static int g_cflow_resume = 0;
+static int g_cflow_lists = 0;
+static int g_cflow_interrupted = 0;
+
+/**
+ * @brief	Pipe ends of process substitutions not yet claimed by the
+ * 			process whose words are being expanded. The expansion of
+ * 			a process only claims the ones opened after it started,
+ * 			so nested substitutions end up with their own producers.
+ */
+static int *g_cflow_fds = NULL;
+static int g_cflow_nfds = 0;
+static int g_cflow_fds_capacity = 0;
+
+/**
+ * @brief	Whether a substitution in the words being expanded could
+ * 			not run, which gives up the command they belong to
+ */
+static int g_cflow_failed = 0;
+
+/**
+ * @brief	State of the parser of a command list. A syntax error is
+ * 			reported once and sets failed; running out of tokens where
+ * 			more are needed sets incomplete instead.
+ */
+typedef struct {
+	const char *line;
+	token_t *tokens;
+	int count;
+	int pos;
+	int failed;
+	int incomplete;
+} cflow_parser_t;
+
+/**
+ * @brief	A stage of a pipeline that holds a compound command,
+ * 			spanning tokens first to end. Redirections of body start
+ * 			at redirect.
+ */
+typedef struct {
+	int first;
+	int redirect;
+	int end;
+	cflow_node_t *body;
+} cflow_stage_t;
+
+static cflow_node_t *cflow_parse_compound(cflow_parser_t *p);
+
+/**
+ * @brief	This routine checks if a token is one of words, unquoted.
+ *
+ * @return	1 if it is. Otherwise, 0.
+ */
+static int cflow_token_is(const char *line, const token_t *token,
+						  const char **words)
+{
+	if (token->type != TOKEN_WORD || token->flags != 0) {
+		return 0;
+	}
+
+	for (int i = 0; words[i] != NULL; i++) {
+		if (token->length == strlen(words[i]) &&
+			strncmp(line + token->offset, words[i], token->length) == 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief	This routine checks if a word is reserved.
+ *
+ * @return	1 if it is. Otherwise, 0.
+ */
+int cflow_is_keyword(const char *word)
+{
+	for (int i = 0; g_keywords[i] != NULL; i++) {
+		if (strcmp(word, g_keywords[i]) == 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief	This routine checks if tokens make up more than a single
+ * 			pipeline: they contain a list operator, a '&' that isn't
+ * 			the last token, or a compound command.
+ *
+ * @return	1 if they do. Otherwise, 0.
+ */
+int cflow_is_list(const char *line, const token_t *tokens, int count)
+{
+	for (int i = 0; i < count; i++) {
+		int type = tokens[i].type;
+		if (type == TOKEN_SEMI || type == TOKEN_AND_IF ||
+			type == TOKEN_OR_IF || type == TOKEN_NEWLINE ||
+			type == TOKEN_DSEMI || type == TOKEN_LPAREN ||
+			type == TOKEN_RPAREN || (type == TOKEN_AMP && i + 1 < count)) {
+			return 1;
+		}
+
+		if ((i == 0 || tokens[i - 1].type == TOKEN_PIPE) &&
+			(cflow_token_is(line, &tokens[i], g_openers) ||
+			 cflow_token_is(line, &tokens[i], g_terminators))) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief	Reserved words that end a compound command
+ */
+static const char *g_closers[] = { "fi", "done", "esac", NULL };
+
+/**
+ * @brief	This routine starts tracking the nesting of a command.
+ */
+void cflow_nesting_init(cflow_nesting_t *nesting)
+{
+	memset(nesting, 0, sizeof(*nesting));
+	nesting->command = 1;
+}
+
+/**
+ * @brief	This routine follows one token of a command through
+ * 			the nesting of its compound commands.
+ */
+static void cflow_nesting_token(cflow_nesting_t *nesting, const char *line,
+								const token_t *token)
+{
+	int type = token->type;
+
+	if (type != TOKEN_NEWLINE) {
+		nesting->continued = 0;
+	}
+
+	if (type == TOKEN_WORD && nesting->redirect) {
+		// a redirection target doesn't end the command position
+		nesting->redirect = 0;
+	} else if (type == TOKEN_WORD && nesting->pattern) {
+		if (cflow_token_is(line, token, g_closers)) {
+			nesting->pattern = 0;
+			nesting->depth--;
+		}
+	} else if (type == TOKEN_WORD && nesting->expect_in) {
+		if (token->length == 2 &&
+			strncmp(line + token->offset, "in", 2) == 0) {
+			nesting->expect_in = 0;
+			nesting->pattern = 1;
+		}
+	} else if (type == TOKEN_WORD) {
+		if (nesting->command && cflow_token_is(line, token, g_openers)) {
+			nesting->depth++;
+			nesting->expect_in = token->length == 4 &&
+								 strncmp(line + token->offset, "case", 4) == 0;
+			// for and case are followed by a name or word first
+			nesting->command = line[token->offset] != 'f' &&
+							   !nesting->expect_in;
+		} else if (nesting->command && cflow_token_is(line, token, g_closers)) {
+			nesting->depth--;
+			nesting->command = 0;
+		} else if (!nesting->command ||
+				   !cflow_token_is(line, token, g_terminators)) {
+			nesting->command = 0;
+		}
+	} else if (type == TOKEN_PIPE || type == TOKEN_AND_IF ||
+			   type == TOKEN_OR_IF) {
+		nesting->continued = 1;
+		nesting->command = 1;
+	} else if (type == TOKEN_SEMI || type == TOKEN_AMP ||
+			   type == TOKEN_NEWLINE) {
+		nesting->command = 1;
+	} else if (type == TOKEN_DSEMI) {
+		nesting->pattern = 1;
+	} else if (type == TOKEN_LPAREN) {
+		nesting->depth++;
+		nesting->command = 1;
+	} else if (type == TOKEN_RPAREN) {
+		nesting->depth--;
+		nesting->command = 0;
+	} else {
+		nesting->redirect = 1;
+	}
+}
+
+/**
+ * @brief	This routine scans the lines added to text since the last
+ * 			call. Lines with an open quote or here-document are left
+ * 			for the next call, once the rest of them has been added.
+ *
+ * @return	1 if the text may be a complete command and has to be
+ * 			parsed to tell. 0 if it surely goes on.
+ */
+int cflow_scan_nesting(cflow_nesting_t *nesting, const char *text)
+{
+	arena_t arena;
+	token_t *tokens;
+
+	arena_init(&arena);
+	int count = lexer_scan(&arena, text + nesting->scanned, &tokens);
+	if (count == LEXER_INCOMPLETE) {
+		arena_release(&arena);
+		return 0;
+	}
+
+	const char *line = text + nesting->scanned;
+	for (int i = 0; i < count; i++) {
+		// a pattern of a case item ends at its ')', (pattern) included
+		if (nesting->pattern && tokens[i].type == TOKEN_RPAREN) {
+			nesting->pattern = 0;
+			nesting->command = 1;
+		} else if (!nesting->pattern || tokens[i].type != TOKEN_LPAREN) {
+			cflow_nesting_token(nesting, line, &tokens[i]);
+		}
+	}
+
+	nesting->scanned += strlen(line);
+	arena_release(&arena);
+
+	return nesting->depth <= 0 && !nesting->continued;
+}
+
+/**
+ * @brief	This routine allocates a node of a command list.
+ *
+ * @return	New node
+ */
+static cflow_node_t *cflow_node(int type)
+{
+	cflow_node_t *node = calloc(1, sizeof(cflow_node_t));
+	if (node == NULL) {
+		perror("psh");
+		exit(1);
+	}
+	node->type = type;
+
+	return node;
+}
+
+/**
+ * @brief	This routine gives a node its own copy of tokens first up
+ * 			to end, and of the text they refer to.
+ */
+static void cflow_node_words(cflow_node_t *node, const char *line,
+							 const token_t *tokens, int first, int end)
+{
+	if (end == first) {
+		return;
+	}
+
+	size_t base = tokens[first].offset;
+	const token_t *last = &tokens[end - 1];
+
+	node->text = strndup(line + base, last->offset + last->length - base);
+	node->words = malloc((end - first) * sizeof(token_t));
+	if (node->text == NULL || node->words == NULL) {
+		perror("psh");
+		exit(1);
+	}
+
+	for (int i = first; i < end; i++) {
+		node->words[i - first] = tokens[i];
+		node->words[i - first].offset -= base;
+	}
+	node->nwords = end - first;
+}
+
+/**
+ * @brief	This routine measures the text that tokens first to last
+ * 			were scanned from. The body of a here-document comes after
+ * 			the rest of its command, so it is not always last.
+ *
+ * @return	Length
+ */
+static size_t cflow_span(const token_t *first, const token_t *last)
+{
+	size_t end = 0;
+
+	for (const token_t *token = first; token <= last; token++) {
+		if (token->offset + token->length > end) {
+			end = token->offset + token->length;
+		}
+	}
+
+	return end - first->offset;
+}
+
+/**
+ * @brief	This routine creates a job with no processes yet,
+ * 			holding its own copy of text.
+ *
+ * @return	New job
+ */
+static job_t *cflow_job(const char *text, size_t len)
+{
+	arena_t arena;
+	arena_init(&arena);
+
+	job_t *job = arena_alloc(&arena, sizeof(job_t));
+	memset(job, 0, sizeof(job_t));
+	job->arena = arena;
+
+	job->cmd = arena_strndup(&job->arena, text, len);
+	job->id = -1;
+	job->refs = 1;
+	job->pgid = -1;
+	job->mode = FG_EXEC;
+
+	return job;
+}
+
+/**
+ * @brief	This routine creates a process running a command list,
+ * 			which it takes over. The list is freed with the job
+ * 			that owns the process.
+ *
+ * @return	New process
+ */
+static process_t *cflow_compound_proc(job_t *job, cflow_node_t *body)
+{
+	process_t *proc = arena_alloc(&job->arena, sizeof(process_t));
+	memset(proc, 0, sizeof(process_t));
+
+	proc->cmd = job->cmd;
+	proc->cmd_len = strlen(job->cmd);
+	proc->line = job->cmd;
+	proc->type = COMMAND_COMPOUND;
+	proc->body = body;
+	proc->pid = -1;
+
+	return proc;
+}
+
+/**
+ * @brief	This routine creates a job running a command list that spans
+ * 			tokens first to last.
+ *
+ * @return	New job
+ */
+static job_t *cflow_compound_job(const char *line, const token_t *first,
+								 const token_t *last, cflow_node_t *body)
+{
+	job_t *job = cflow_job(line + first->offset, cflow_span(first, last));
+	job->root = cflow_compound_proc(job, body);
+
+	return job;
+}
+
+/**
+ * @brief	This routine parses the pipeline spanning first to last
+ * 			into a job template of its own, from a copy of its tokens.
+ *
+ * @return	Job template, or NULL on a syntax error.
+ */
+static job_t *cflow_pipeline(const char *line, const token_t *first,
+							 const token_t *last)
+{
+	job_t *job = cflow_job(line + first->offset, cflow_span(first, last));
+	int count = last - first + 1;
+
+	token_t *tokens = arena_alloc(&job->arena, count * sizeof(token_t));
+	for (int i = 0; i < count; i++) {
+		tokens[i] = first[i];
+		tokens[i].offset -= first->offset;
+	}
+
+	job = command_parse_tokens(job, job->cmd, tokens, count);
+
+	if (job != NULL) {
+		cflow_expand_static(job);
+	}
+
+	return job;
+}
+
+/**
+ * @brief	This routine reports a syntax error at the current token.
+ * 			Running out of tokens isn't one, the command just goes
+ * 			on on the next line.
+ */
+static void cflow_error(cflow_parser_t *p)
+{
+	if (p->failed || p->incomplete) {
+		return;
+	}
+
+	if (p->pos >= p->count) {
+		p->incomplete = 1;
+	} else {
+		command_syntax_error(p->line, &p->tokens[p->pos]);
+		p->failed = 1;
+	}
+}
+
+/**
+ * @brief	This routine checks the type of the current token.
+ *
+ * @return	1 if it has type. Otherwise, 0.
+ */
+static int cflow_at(cflow_parser_t *p, int type)
+{
+	return p->pos < p->count && p->tokens[p->pos].type == type;
+}
+
+/**
+ * @brief	This routine checks if the current token is the reserved
+ * 			word word.
+ *
+ * @return	1 if it is. Otherwise, 0.
+ */
+static int cflow_at_word(cflow_parser_t *p, const char *word)
+{
+	const char *words[] = { word, NULL };
+
+	return p->pos < p->count &&
+		   cflow_token_is(p->line, &p->tokens[p->pos], words);
+}
+
+/**
+ * @brief	This routine checks if the current token ends a compound
+ * 			list.
+ *
+ * @return	1 if it does. Otherwise, 0.
+ */
+static int cflow_at_end(cflow_parser_t *p)
+{
+	return p->pos >= p->count || cflow_at(p, TOKEN_DSEMI) ||
+		   cflow_at(p, TOKEN_RPAREN) ||
+		   cflow_token_is(p->line, &p->tokens[p->pos], g_terminators);
+}
+
+/**
+ * @brief	This routine skips the reserved word word.
+ *
+ * @return	0 on success, -1 if it isn't the current token.
+ */
+static int cflow_expect(cflow_parser_t *p, const char *word)
+{
+	if (!cflow_at_word(p, word)) {
+		cflow_error(p);
+		return -1;
+	}
+
+	p->pos++;
+	return 0;
+}
+
+/**
+ * @brief	This routine skips the newlines of a multi-line command.
+ */
+static void cflow_skip_newlines(cflow_parser_t *p)
+{
+	while (cflow_at(p, TOKEN_NEWLINE)) {
+		p->pos++;
+	}
+}
+
+/**
+ * @brief	This routine parses a compound list that can't be empty.
+ *
+ * @return	List, or NULL on a syntax error.
+ */
+static cflow_node_t *cflow_parse_body(cflow_parser_t *p)
+{
+	cflow_node_t *list = cflow_parse_compound(p);
+	if (list == NULL) {
+		cflow_error(p);
+	}
+
+	return list;
+}
+
+/**
+ * @brief	This routine parses "if list then list [elif ...] [else
+ * 			list] fi". An elif is parsed as an if of its own, which
+ * 			takes the fi along.
+ *
+ * @return	Node, or NULL on a syntax error.
+ */
+static cflow_node_t *cflow_parse_if(cflow_parser_t *p)
+{
+	cflow_node_t *node = cflow_node(CFLOW_IF);
+	p->pos++;
+
+	node->cond = cflow_parse_body(p);
+	if (node->cond != NULL && cflow_expect(p, "then") == 0) {
+		node->body = cflow_parse_body(p);
+	}
+
+	if (node->body != NULL && cflow_at_word(p, "elif")) {
+		node->alt = cflow_parse_if(p);
+		if (node->alt != NULL) {
+			return node;
+		}
+	} else if (node->body != NULL && cflow_at_word(p, "else")) {
+		p->pos++;
+		node->alt = cflow_parse_body(p);
+		if (node->alt != NULL && cflow_expect(p, "fi") == 0) {
+			return node;
+		}
+	} else if (node->body != NULL && cflow_expect(p, "fi") == 0) {
+		return node;
+	}
+
+	cflow_free(node);
+	return NULL;
+}
+
+/**
+ * @brief	This routine parses "while list do list done", or the
+ * 			same with until.
+ *
+ * @return	Node, or NULL on a syntax error.
+ */
+static cflow_node_t *cflow_parse_loop(cflow_parser_t *p, int type)
+{
+	cflow_node_t *node = cflow_node(type);
+	p->pos++;
+
+	node->cond = cflow_parse_body(p);
+	if (node->cond != NULL && cflow_expect(p, "do") == 0) {
+		node->body = cflow_parse_body(p);
+		if (node->body != NULL && cflow_expect(p, "done") == 0) {
+			return node;
+		}
+	}
+
+	cflow_free(node);
+	return NULL;
+}
+
+/**
+ * @brief	This routine parses "for name [in word...] do list done".
+ *
+ * @return	Node, or NULL on a syntax error.
+ */
+static cflow_node_t *cflow_parse_for(cflow_parser_t *p)
+{
+	cflow_node_t *node = cflow_node(CFLOW_FOR);
+	p->pos++;
+
+	token_t *name = &p->tokens[p->pos];
+	if (!cflow_at(p, TOKEN_WORD) || name->flags != 0 ||
+		!var_is_name(p->line + name->offset, name->length)) {
+		cflow_error(p);
+		cflow_free(node);
+		return NULL;
+	}
+	node->name = strndup(p->line + name->offset, name->length);
+	p->pos++;
+
+	cflow_skip_newlines(p);
+	if (cflow_at_word(p, "in")) {
+		int first = ++p->pos;
+		while (cflow_at(p, TOKEN_WORD)) {
+			p->pos++;
+		}
+		cflow_node_words(node, p->line, p->tokens, first, p->pos);
+
+		if (!cflow_at(p, TOKEN_SEMI) && !cflow_at(p, TOKEN_NEWLINE)) {
+			cflow_error(p);
+			cflow_free(node);
+			return NULL;
+		}
+		p->pos++;
+	} else if (cflow_at(p, TOKEN_SEMI)) {
+		p->pos++;
+	}
+
+	cflow_skip_newlines(p);
+	if (cflow_expect(p, "do") == 0) {
+		node->body = cflow_parse_body(p);
+		if (node->body != NULL && cflow_expect(p, "done") == 0) {
+			return node;
+		}
+	}
+
+	cflow_free(node);
+	return NULL;
+}
+
+/**
+ * @brief	This routine parses one item of a case command,
+ * 			"[(] pattern [| pattern...] ) list [;;]".
+ *
+ * @return	Node, or NULL on a syntax error.
+ */
+static cflow_node_t *cflow_parse_item(cflow_parser_t *p)
+{
+	cflow_node_t *node = cflow_node(CFLOW_ITEM);
+
+	if (cflow_at(p, TOKEN_LPAREN)) {
+		p->pos++;
+	}
+
+	// the pipes between patterns are kept, and skipped when matching
+	int first = p->pos;
+	while (cflow_at(p, TOKEN_WORD)) {
+		p->pos++;
+		if (!cflow_at(p, TOKEN_PIPE)) {
+			break;
+		}
+		p->pos++;
+	}
+
+	if (p->pos == first || !cflow_at(p, TOKEN_RPAREN)) {
+		cflow_error(p);
+		cflow_free(node);
+		return NULL;
+	}
+	cflow_node_words(node, p->line, p->tokens, first, p->pos);
+	p->pos++;
+
+	node->body = cflow_parse_compound(p);
+	if (p->failed || p->incomplete) {
+		cflow_free(node);
+		return NULL;
+	}
+
+	if (cflow_at(p, TOKEN_DSEMI)) {
+		p->pos++;
+		cflow_skip_newlines(p);
+	} else if (!cflow_at_word(p, "esac")) {
+		cflow_error(p);
+		cflow_free(node);
+		return NULL;
+	}
+
+	return node;
+}
+
+/**
+ * @brief	This routine parses "case word in [item...] esac".
+ * 			The items are chained through alt.
+ *
+ * @return	Node, or NULL on a syntax error.
+ */
+static cflow_node_t *cflow_parse_case(cflow_parser_t *p)
+{
+	cflow_node_t *node = cflow_node(CFLOW_CASE);
+	cflow_node_t **link = &node->alt;
+	p->pos++;
+
+	if (!cflow_at(p, TOKEN_WORD)) {
+		cflow_error(p);
+		cflow_free(node);
+		return NULL;
+	}
+	cflow_node_words(node, p->line, p->tokens, p->pos, p->pos + 1);
+	p->pos++;
+
+	cflow_skip_newlines(p);
+	if (cflow_expect(p, "in") < 0) {
+		cflow_free(node);
+		return NULL;
+	}
+	cflow_skip_newlines(p);
+
+	while (!cflow_at_word(p, "esac")) {
+		*link = cflow_parse_item(p);
+		if (*link == NULL) {
+			cflow_free(node);
+			return NULL;
+		}
+		link = &(*link)->alt;
+	}
+	p->pos++;
+
+	return node;
+}
+
+/**
+ * @brief	This routine parses the compound command at the current
+ * 			token.
+ *
+ * @return	Node, or NULL on a syntax error.
+ */
+static cflow_node_t *cflow_parse_command(cflow_parser_t *p)
+{
+	if (cflow_at_word(p, "if")) {
+		return cflow_parse_if(p);
+	} else if (cflow_at_word(p, "while")) {
+		return cflow_parse_loop(p, CFLOW_WHILE);
+	} else if (cflow_at_word(p, "until")) {
+		return cflow_parse_loop(p, CFLOW_UNTIL);
+	} else if (cflow_at_word(p, "for")) {
+		return cflow_parse_for(p);
+	}
+
+	return cflow_parse_case(p);
+}
+
+/**
+ * @brief	This routine skips the redirections after a compound
+ * 			command, or the words and redirections of a simple one.
+ *
+ * @return	0 on success, -1 on a syntax error.
+ */
+static int cflow_skip_stage(cflow_parser_t *p, int compound)
+{
+	while (p->pos < p->count) {
+		int type = p->tokens[p->pos].type;
+
+		if (cflow_is_redirect(type)) {
+			p->pos++;
+			if (!cflow_at(p, TOKEN_WORD)) {
+				// a redirection can't go on on the next line
+				if (p->pos >= p->count) {
+					command_syntax_error(p->line, NULL);
+					p->failed = 1;
+				}
+				cflow_error(p);
+				return -1;
+			}
+		} else if (type != TOKEN_WORD || compound) {
+			break;
+		}
+		p->pos++;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief	This routine builds the job of a pipeline that has compound
+ * 			commands among its stages. Simple stages are parsed right
+ * 			from a copy of the tokens, compound ones become processes
+ * 			running their nodes.
+ *
+ * @return	Job template
+ */
+static job_t *cflow_pipeline_job(cflow_parser_t *p, cflow_stage_t *stages,
+								 int count)
+{
+	int first = stages[0].first;
+	int ntokens = stages[count - 1].end - first;
+	job_t *job = cflow_compound_job(p->line, &p->tokens[first],
+									&p->tokens[first + ntokens - 1], NULL);
+	size_t base = p->tokens[first].offset;
+
+	token_t *tokens = arena_alloc(&job->arena, ntokens * sizeof(token_t));
+	for (int i = 0; i < ntokens; i++) {
+		tokens[i] = p->tokens[first + i];
+		tokens[i].offset -= base;
+	}
+
+	process_t **link = &job->root;
+	for (int i = 0; i < count; i++) {
+		cflow_stage_t *stage = &stages[i];
+		token_t *stage_tokens = tokens + stage->first - first;
+		process_t *proc;
+
+		if (stage->body == NULL) {
+			cflow_parse(&job->arena, job->cmd, stage_tokens,
+						stage->end - stage->first, &proc);
+		} else {
+			proc = cflow_compound_proc(job, stage->body);
+			stage->body = NULL;
+
+			token_t *last = &tokens[stage->end - first - 1];
+			proc->cmd = job->cmd + stage_tokens->offset;
+			proc->cmd_len = last->offset + last->length - stage_tokens->offset;
+
+			for (int t = stage->redirect - first; t < stage->end - first;
+				 t += 2) {
+				cflow_redirect(proc, &tokens[t], &tokens[t + 1]);
+			}
+		}
+
+		*link = proc;
+		link = &proc->next;
+	}
+	*link = NULL;
+
+	cflow_expand_static(job);
+	return job;
+}
+
+/**
+ * @brief	This routine parses a pipeline. A compound command on its
+ * 			own is run as it is, anything else becomes a job template.
+ *
+ * @return	Node, or NULL on a syntax error.
+ */
+static cflow_node_t *cflow_parse_pipeline(cflow_parser_t *p)
+{
+	int start = p->pos;
+	int count = 0;
+	int capacity = 4;
+	int compound = 0;
+	cflow_stage_t *stages = malloc(capacity * sizeof(cflow_stage_t));
+	if (stages == NULL) {
+		perror("psh");
+		exit(1);
+	}
+
+	for (;;) {
+		if (count == capacity) {
+			capacity *= 2;
+			stages = realloc(stages, capacity * sizeof(cflow_stage_t));
+			if (stages == NULL) {
+				perror("psh");
+				exit(1);
+			}
+		}
+
+		cflow_stage_t *stage = &stages[count++];
+		stage->first = p->pos;
+		stage->body = NULL;
+
+		if (p->pos < p->count &&
+			cflow_token_is(p->line, &p->tokens[p->pos], g_openers)) {
+			stage->body = cflow_parse_command(p);
+			if (stage->body == NULL) {
+				break;
+			}
+			compound = 1;
+		}
+
+		stage->redirect = p->pos;
+		if (cflow_skip_stage(p, stage->body != NULL) < 0) {
+			break;
+		}
+		stage->end = p->pos;
+
+		if (stage->end == stage->first) {
+			cflow_error(p);
+			break;
+		}
+
+		if (!cflow_at(p, TOKEN_PIPE)) {
+			break;
+		}
+		p->pos++;
+		cflow_skip_newlines(p);
+	}
+
+	cflow_node_t *node = NULL;
+
+	if (p->failed || p->incomplete) {
+		for (int i = 0; i < count; i++) {
+			cflow_free(stages[i].body);
+		}
+	} else if (count == 1 && stages[0].body != NULL &&
+			   stages[0].redirect == stages[0].end) {
+		node = stages[0].body;
+	} else if (compound) {
+		node = cflow_node(CFLOW_JOB);
+		node->job = cflow_pipeline_job(p, stages, count);
+	} else {
+		job_t *job = cflow_pipeline(p->line, &p->tokens[start],
+									&p->tokens[p->pos - 1]);
+		if (job == NULL) {
+			p->failed = 1;
+		} else {
+			node = cflow_node(CFLOW_JOB);
+			node->job = job;
+		}
+	}
+
+	free(stages);
+	return node;
+}
+
+/**
+ * @brief	This routine parses pipelines joined by '&&' and '||'.
+ * 			If a '&' follows, the list is made a background job; a
+ * 			single pipeline simply runs in the background itself.
+ *
+ * @return	First node of the list, or NULL on a syntax error.
+ */
+static cflow_node_t *cflow_parse_and_or(cflow_parser_t *p)
+{
+	int start = p->pos;
+	cflow_node_t *head = cflow_parse_pipeline(p);
+	cflow_node_t *tail = head;
+
+	while (tail != NULL &&
+		   (cflow_at(p, TOKEN_AND_IF) || cflow_at(p, TOKEN_OR_IF))) {
+		int op = cflow_at(p, TOKEN_AND_IF) ? CFLOW_AND : CFLOW_OR;
+		p->pos++;
+		cflow_skip_newlines(p);
+
+		tail->next = cflow_parse_pipeline(p);
+		tail = tail->next;
+		if (tail != NULL) {
+			tail->op = op;
+		}
+	}
+
+	if (tail == NULL) {
+		cflow_free(head);
+		return NULL;
+	}
+
+	if (cflow_at(p, TOKEN_AMP)) {
+		if (head->next == NULL && head->type == CFLOW_JOB) {
+			head->job->mode = BG_EXEC;
+		} else {
+			job_t *job = cflow_compound_job(p->line, &p->tokens[start],
+											&p->tokens[p->pos - 1], head);
+			job->mode = BG_EXEC;
+			cflow_expand_static(job);
+			head = cflow_node(CFLOW_JOB);
+			head->job = job;
+		}
+	}
+
+	return head;
+}
+
+/**
+ * @brief	This routine parses and-or lists separated by ';', '&' or
+ * 			newlines, up to a token that ends a compound list.
+ *
+ * @return	First node of the list, or NULL if it is empty or on
+ * 			a syntax error.
+ */
+static cflow_node_t *cflow_parse_compound(cflow_parser_t *p)
+{
+	cflow_node_t *head = NULL;
+	cflow_node_t **link = &head;
 
-	if (!token_arr) {
-		perror("psh");
-		exit(1);
+	cflow_skip_newlines(p);
+	while (!cflow_at_end(p)) {
+		*link = cflow_parse_and_or(p);
+		if (*link == NULL) {
+			cflow_free(head);
+			return NULL;
+		}
+		while (*link != NULL) {
+			link = &(*link)->next;
+		}
+
+		if (cflow_at(p, TOKEN_SEMI) || cflow_at(p, TOKEN_AMP) ||
+			cflow_at(p, TOKEN_NEWLINE)) {
+			p->pos++;
+			cflow_skip_newlines(p);
+		} else if (!cflow_at_end(p)) {
+			cflow_error(p);
+			cflow_free(head);
+			return NULL;
+		}
+	}
+
+	return head;
+}
+
+/**
+ * @brief	This routine compiles a command list, with all the compound
+ * 			commands in it, into nodes that are run as they are every
+ * 			time. Each pipeline becomes a job template of its own.
+ *
+ * @return	Job running the list, or NULL on a syntax error or if the
+ * 			list goes on on the next line, which sets *incomplete.
+ */
+job_t *cflow_parse_list(const char *line, token_t *tokens, int count,
+						int *incomplete)
+{
+	cflow_parser_t parser = { line, tokens, count, 0, 0, 0 };
+
+	cflow_node_t *list = cflow_parse_compound(&parser);
+	if (parser.pos < count) {
+		cflow_error(&parser);
+	}
+
+	*incomplete = parser.incomplete;
+	if (parser.failed || parser.incomplete) {
+		cflow_free(list);
+		return NULL;
+	}
+
+	// a lone pipeline needs no list around it
+	if (list->type == CFLOW_JOB && list->next == NULL) {
+		job_t *job = list->job;
+		list->job = NULL;
+		cflow_free(list);
+		return job;
+	}
+
+	return cflow_compound_job(line, &tokens[0], &tokens[count - 1], list);
+}
+
+/**
+ * @brief	This routine makes the loops running now stop, or resume
+ * 			with their next iteration, once control gets back to them.
+ *
+ * @return	0 on success, -1 if no loop is running.
+ */
+int cflow_loop_control(int levels, int resume)
+{
+	if (g_cflow_loops == 0) {
+		return -1;
+	}
+
+	g_cflow_skip = levels < g_cflow_loops ? levels : g_cflow_loops;
+	g_cflow_resume = resume;
+	return 0;
+}
+
+/**
+ * @brief	This routine checks, after a run of its condition or body,
+ * 			if a loop has to stop because of break or continue.
+ *
+ * @return	1 if it has to. Otherwise, 0.
+ */
+static int cflow_loop_done(void)
+{
+	if (g_cflow_interrupted) {
+		return 1;
+	}
+
+	if (g_cflow_skip == 0) {
+		return 0;
+	}
+
+	if (g_cflow_skip == 1 && g_cflow_resume) {
+		g_cflow_skip = 0;
+		return 0;
 	}
 
-	while ((token = strtok_r(segment, " \t\r\n\a", &segment))) {
-		glob_t glob_buffer;
-		int glob_count = 0;
-		if (strchr(token, '*') != NULL || strchr(token, '?') != NULL) {
-			glob(token, 0, NULL, &glob_buffer);
-			glob_count = glob_buffer.gl_pathc;
+	g_cflow_skip--;
+	return 1;
+}
+
+/**
+ * @brief	This routine runs a while or until loop.
+ *
+ * @return	Status of the last run of the body, 0 if it never ran.
+ */
+static int cflow_run_loop(cflow_node_t *node)
+{
+	int status = 0;
+
+	g_cflow_loops++;
+	for (;;) {
+		int cond = cflow_run(node->cond);
+		if (cflow_loop_done() || (cond == 0) == (node->type == CFLOW_UNTIL)) {
+			break;
 		}
 
-		if (pos + glob_count >= buffer_size) {
-			buffer_size += PSH_COMMAND_BUFSIZE;
-			buffer_size += glob_count;
-			token_arr =
-				(char **)realloc(token_arr, buffer_size * sizeof(char *));
-			if (!token_arr) {
-				perror("psh");
-				exit(1);
+		status = cflow_run(node->body);
+		if (cflow_loop_done()) {
+			break;
+		}
+	}
+	g_cflow_loops--;
+
+	return status;
+}
+
+/**
+ * @brief	This routine runs a for loop. The words are expanded
+ * 			once, before the first run of the body.
+ *
+ * @return	Status of the last run of the body, 0 if it never ran.
+ */
+static int cflow_run_for(cflow_node_t *node)
+{
+	process_t words;
+	arena_t arena;
+	int status = 0;
+
+	memset(&words, 0, sizeof(words));
+	words.line = node->text;
+	words.words = node->words;
+	words.nwords = node->nwords;
+
+	arena_init(&arena);
+	if (cflow_expand(&arena, &words) < 0) {
+		words.argc = 0;
+		status = 2;
+	}
+
+	g_cflow_loops++;
+	for (int i = 0; i < words.argc; i++) {
+		var_set(node->name, words.argv[i], 0);
+
+		status = cflow_run(node->body);
+		if (cflow_loop_done()) {
+			break;
+		}
+	}
+	g_cflow_loops--;
+
+	for (int i = 0; i < words.nfds; i++) {
+		close(words.fds[i]);
+	}
+	arena_release(&arena);
+	return status;
+}
+
+/**
+ * @brief	This routine closes the pipe ends of process substitutions
+ * 			that no process claimed, all but the first ones.
+ */
+static void cflow_drop_fds(int first)
+{
+	while (g_cflow_nfds > first) {
+		close(g_cflow_fds[--g_cflow_nfds]);
+	}
+}
+
+/**
+ * @brief	This routine runs the first item of a case command with
+ * 			a pattern that matches its word.
+ *
+ * @return	Status of the item, 0 if none matched.
+ */
+static int cflow_run_case(cflow_node_t *node)
+{
+	arena_t arena;
+	int status = 0;
+	int first_fd = g_cflow_nfds;
+
+	arena_init(&arena);
+	int failed = g_cflow_failed;
+	g_cflow_failed = 0;
+	char *word = lexer_word(&arena, node->text, &node->words[0], 0);
+
+	if (g_cflow_failed) {
+		g_cflow_failed = failed;
+		cflow_drop_fds(first_fd);
+		arena_release(&arena);
+		return 2;
+	}
+	g_cflow_failed = failed;
+
+	for (cflow_node_t *item = node->alt; item != NULL; item = item->alt) {
+		for (int i = 0; i < item->nwords; i++) {
+			if (item->words[i].type != TOKEN_WORD) {
+				continue;
 			}
+
+			char *pattern = lexer_word(&arena, item->text, &item->words[i],
+									   LEXER_GLOB_ESCAPE);
+			if (wildcard_match(pattern, word)) {
+				cflow_drop_fds(first_fd);
+				status = cflow_run(item->body);
+				arena_release(&arena);
+				return status;
+			}
+		}
+	}
+
+	cflow_drop_fds(first_fd);
+	arena_release(&arena);
+	return status;
+}
+
+/**
+ * @brief	This routine runs a node of a command list.
+ *
+ * @return	Status
+ */
+static int cflow_run_node(cflow_node_t *node)
+{
+	int status = 0;
+
+	switch (node->type) {
+	case CFLOW_JOB:
+		return job_run(job_clone(node->job));
+	case CFLOW_IF:
+		status = cflow_run(node->cond);
+		if (g_cflow_skip == 0 && !g_cflow_interrupted) {
+			status = cflow_run(status == 0 ? node->body : node->alt);
+		}
+		break;
+	case CFLOW_WHILE:
+	case CFLOW_UNTIL:
+		status = cflow_run_loop(node);
+		break;
+	case CFLOW_FOR:
+		status = cflow_run_for(node);
+		break;
+	case CFLOW_CASE:
+		status = cflow_run_case(node);
+		break;
+	}
+
+	var_set_status(status);
+	return status;
+}
+
+/**
+ * @brief	This routine runs a command list. A node joined by '&&' or
+ * 			'||' is skipped, without starting anything, unless the
+ * 			status so far calls for it. Like the shell itself, every
+ * 			list gives up once ^C killed one of its commands.
+ *
+ * @return	Status of the last pipeline that ran
+ */
+int cflow_run(cflow_node_t *node)
+{
+	int status = 0;
+
+	g_cflow_lists++;
+	for (; node != NULL; node = node->next) {
+		if (g_cflow_skip > 0 || g_cflow_interrupted) {
+			break;
+		}
+
+		if ((node->op == CFLOW_AND && status != 0) ||
+			(node->op == CFLOW_OR && status == 0)) {
+			continue;
+		}
+
+		status = cflow_run_node(node);
+		if (node->type == CFLOW_JOB && status == 128 + SIGINT) {
+			g_cflow_interrupted = 1;
+		}
+	}
+
+	if (--g_cflow_lists == 0) {
+		g_cflow_interrupted = 0;
+	}
+
+	return status;
+}
+
+/**
+ * @brief	This routine checks if a job is a single builtin that only
+ * 			prints, so its output can be captured without a fork.
+ * 			The job gets expanded on the way.
+ *
+ * @return	1 if it is, -1 if its expansion failed. Otherwise, 0.
+ */
+static int cflow_is_pure(job_t *job)
+{
+	process_t *proc = job->root;
+
+	if (proc->next != NULL || proc->in_word != NULL ||
+		proc->out_word != NULL || job->mode != FG_EXEC || job->timed) {
+		return 0;
+	}
+
+	if (proc->argv == NULL && cflow_expand(&job->arena, proc) < 0) {
+		return -1;
+	}
+
+	if (proc->type != COMMAND_BUILTIN) {
+		return 0;
+	}
+
+	const builtin_t *builtin =
+		proc->argc > 0 ? builtin_lookup(proc->argv[0]) : NULL;
+	return proc->argc == 0 || (builtin->flags & BUILTIN_PURE);
+}
+
+/**
+ * @brief	This routine runs a pure builtin with stdout going to
+ * 			a growing memory buffer.
+ *
+ * @return	Output, which the caller frees, or NULL if it can't be
+ * 			captured in memory.
+ */
+static char *cflow_capture_builtin(job_t *job, size_t *size)
+{
+	char *data = NULL;
+	FILE *out = open_memstream(&data, size);
+	if (out == NULL) {
+		return NULL;
+	}
+
+	// glibc lets stdout point elsewhere for a while
+	fflush(stdout);
+	FILE *saved = stdout;
+	stdout = out;
+	int status = command_builtin(job->root);
+	stdout = saved;
+	fclose(out);
+
+	var_set_status(status);
+	return data;
+}
+
+/**
+ * @brief	This routine runs a job in the background with stdout going
+ * 			to a pipe, and reads all of it into the arena as it comes.
+ *
+ * @return	Output, not terminated
+ */
+static char *cflow_capture_job(arena_t *arena, job_t *job, size_t *size)
+{
+	int fd[2];
+	size_t capacity = CFLOW_SUBST_CHUNK;
+	char *data = arena_alloc(arena, capacity);
+	*size = 0;
+
+	if (pipe2(fd, O_CLOEXEC) < 0) {
+		perror("psh");
+		job_free(job);
+		return data;
+	}
+
+	fflush(stdout);
+	int saved_stdout = fcntl(1, F_DUPFD_CLOEXEC, 0);
+	dup2(fd[1], 1);
+	close(fd[1]);
+
+	// job_run() may be done with the job by the time it returns
+	job->mode = ASYNC_EXEC;
+	job->refs++;
+	job_run(job);
+	int id = job_get(job->id) == job ? job->id : -1;
+	job_free(job);
+
+	// now only the job holds the write end
+	dup2(saved_stdout, 1);
+	close(saved_stdout);
+
+	ssize_t len;
+	for (;;) {
+		if (capacity - *size < CFLOW_SUBST_CHUNK) {
+			data = arena_realloc(arena, data, capacity, 2 * capacity);
+			capacity *= 2;
+		}
+
+		len = read(fd[0], data + *size, capacity - *size);
+		if (len < 0 && errno == EINTR) {
+			continue;
 		}
+		if (len <= 0) {
+			break;
+		}
+		*size += len;
+	}
+	close(fd[0]);
+
+	var_set_status(id > 0 ? job_wait_jobs(&id, 1, 0, NULL) : 1);
+	return data;
+}
+
+/**
+ * @brief	This routine parses the command of a substitution. One that
+ * 			is malformed, or cut short, gives up the command being
+ * 			expanded, like a syntax error anywhere else.
+ *
+ * @return	Job, or NULL if there is nothing to run.
+ */
+static job_t *cflow_parse_subst(const char *text, size_t len)
+{
+	char *line = strndup(text, len);
+	if (line == NULL) {
+		perror("psh");
+		exit(1);
+	}
+
+	job_t *job = command_parse(line);
+	free(line);
+
+	if (job == NULL && command_is_incomplete()) {
+		command_syntax_error(NULL, NULL);
+	}
+	if (job == NULL && command_is_malformed()) {
+		g_cflow_failed = 1;
+	}
 
-		if (glob_count > 0) {
-			int i;
-			for (i = 0; i < glob_count; i++) {
-				token_arr[pos++] = strdup(glob_buffer.gl_pathv[i]);
+	return job;
+}
+
+/**
+ * @brief	This routine runs the command of a substitution and
+ * 			collects its output. A lone builtin that only prints
+ * 			runs in-process, anything else is read through a pipe.
+ *
+ * @return	Output allocated from the arena, with trailing newlines
+ * 			removed.
+ */
+char *cflow_substitute(arena_t *arena, const char *text, size_t len)
+{
+	job_t *job = cflow_parse_subst(text, len);
+	if (job == NULL) {
+		return arena_strndup(arena, "", 0);
+	}
+
+	char *data;
+	size_t size = 0;
+	int pure = cflow_is_pure(job);
+
+	if (pure < 0) {
+		job_free(job);
+		var_set_status(2);
+		return arena_strndup(arena, "", 0);
+	}
+
+	if (pure) {
+		char *output = cflow_capture_builtin(job, &size);
+		if (output != NULL) {
+			job_free(job);
+			while (size > 0 && output[size - 1] == '\n') {
+				size--;
 			}
-			globfree(&glob_buffer);
-		} else {
-			token_arr[pos] = token;
-			pos++;
+			data = arena_strndup(arena, output, size);
+			free(output);
+			return data;
+		}
+	}
+
+	data = cflow_capture_job(arena, job, &size);
+	while (size > 0 && data[size - 1] == '\n') {
+		size--;
+	}
+	data[size] = '\0';
+
+	return data;
+}
+
+/**
+ * @brief	This routine starts the command of a process substitution
+ * 			as a job of its own, running alongside the command being
+ * 			expanded. Its stdout, or stdin for >(...), is a pipe whose
+ * 			other end is left for that command to open.
+ *
+ * @return	Path of that end in /dev/fd
+ */
+char *cflow_process_subst(arena_t *arena, const char *text, size_t len,
+						  int output)
+{
+	job_t *job = cflow_parse_subst(text, len);
+	if (job == NULL) {
+		return arena_strndup(arena, "", 0);
+	}
+
+	int fd[2];
+	if (pipe2(fd, O_CLOEXEC) < 0) {
+		perror("psh");
+		job_free(job);
+		g_cflow_failed = 1;
+		return arena_strndup(arena, "", 0);
+	}
+
+	int target = output ? 0 : 1;
+	int end = output ? fd[1] : fd[0];
+
+	if (g_cflow_nfds == g_cflow_fds_capacity) {
+		g_cflow_fds_capacity = g_cflow_fds_capacity ? 2 * g_cflow_fds_capacity
+													: 8;
+		g_cflow_fds = realloc(g_cflow_fds, g_cflow_fds_capacity * sizeof(int));
+		if (g_cflow_fds == NULL) {
+			perror("psh");
+			exit(1);
+		}
+	}
+	g_cflow_fds[g_cflow_nfds++] = end;
+
+	fflush(stdout);
+	int saved = fcntl(target, F_DUPFD_CLOEXEC, 0);
+	dup2(fd[output ? 0 : 1], target);
+	close(fd[output ? 0 : 1]);
+
+	// the job table owns it from now on, and $? is left alone
+	int status = var_get_status();
+	job->mode = SUBST_EXEC;
+	job_run(job);
+	var_set_status(status);
+
+	dup2(saved, target);
+	close(saved);
+
+	char path[32];
+	snprintf(path, sizeof(path), "/dev/fd/%d", end);
+	return arena_strdup(arena, path);
+}
+
+/**
+ * @brief	This routine frees a command list, with the job templates
+ * 			and nested lists it holds.
+ */
+void cflow_free(cflow_node_t *node)
+{
+	while (node != NULL) {
+		cflow_node_t *next = node->next;
+
+		if (node->job != NULL) {
+			job_free(node->job);
 		}
+		cflow_free(node->cond);
+		cflow_free(node->body);
+		cflow_free(node->alt);
+		free(node->name);
+		free(node->text);
+		free(node->words);
+		free(node);
+
+		node = next;
 	}
+}
+
+/**
+ * @brief	This routine creates a new process structure from the
+ * 			tokens of one pipeline stage. Words are only recorded,
+ * 			cflow_expand() turns them into argv later.
+ * 
+ * @return	Number of tokens consumed, or -1 on a syntax error.
+ */
+int cflow_parse(arena_t *arena, const char *line, token_t *tokens, int count,
+				process_t **proc)
+{
+	process_t *new_proc = arena_alloc(arena, sizeof(process_t));
+	memset(new_proc, 0, sizeof(process_t));
+	new_proc->line = line;
+	new_proc->words = arena_alloc(arena, count * sizeof(token_t));
+	new_proc->pid = -1;
 
-	int i = 0;
-	int argc = 0;
-	char *in_path = NULL;
-	char *out_path = NULL;
+	int i;
+	for (i = 0; i < count; i++) {
+		token_t *token = &tokens[i];
 
-	while (i < pos) {
-		if (token_arr[i][0] == '<' || token_arr[i][0] == '>') {
+		if (token->type != TOKEN_WORD && !cflow_is_redirect(token->type)) {
 			break;
 		}
+
+		if (token->type == TOKEN_WORD) {
+			new_proc->words[new_proc->nwords++] = *token;
+			continue;
+		}
+
+		// redirection, the target is the next word
+		if (i + 1 >= count || tokens[i + 1].type != TOKEN_WORD) {
+			return -1;
+		}
+
+		cflow_redirect(new_proc, token, &tokens[i + 1]);
 		i++;
 	}
-	argc = i;
-
-	for (; i < pos; i++) {
-		if (token_arr[i][0] == '<') {
-			if (strlen(token_arr[i]) == 1) {
-				in_path = (char *)malloc((strlen(token_arr[i + 1]) + 1) *
-										 sizeof(char));
-				strcpy(in_path, token_arr[i + 1]);
-				i++;
-			} else {
-				in_path = (char *)malloc(strlen(token_arr[i]) * sizeof(char));
-				strcpy(in_path, token_arr[i] + 1);
-			}
-		} else if (token_arr[i][0] == '>') {
-			if (strlen(token_arr[i]) == 1) {
-				out_path = (char *)malloc((strlen(token_arr[i + 1]) + 1) *
-										  sizeof(char));
-				strcpy(out_path, token_arr[i + 1]);
-				i++;
-			} else {
-				out_path = (char *)malloc(strlen(token_arr[i]) * sizeof(char));
-				strcpy(out_path, token_arr[i] + 1);
+
+	if (i == 0) {
+		return -1;
+	}
+
+	token_t *last = &tokens[i - 1];
+	new_proc->cmd = (char *)line + tokens[0].offset;
+	new_proc->cmd_len = last->offset + last->length - tokens[0].offset;
+
+	*proc = new_proc;
+	return i;
+}
+
+/**
+ * @brief	This routine adds the fields of a word whose unquoted
+ * 			expansions were split at LEXER_FIELD_SEP to argv. Empty
+ * 			fields are dropped, unless the word was quoted and
+ * 			nothing split it.
+ */
+static void cflow_add_fields(arena_t *arena, char ***argv, int *pos,
+							 int *size, char *value, int quoted)
+{
+	char *field = value;
+	for (;;) {
+		char *end = strchr(field, LEXER_FIELD_SEP);
+		if (end != NULL) {
+			*end = '\0';
+		}
+
+		if (*field != '\0' || (quoted && field == value && end == NULL)) {
+			// keep a slot free for the terminating NULL
+			if (*pos + 2 >= *size) {
+				*argv = arena_realloc(arena, *argv, *size * sizeof(char *),
+									  2 * *size * sizeof(char *));
+				*size *= 2;
 			}
-		} else {
+			(*argv)[(*pos)++] = field;
+		}
+
+		if (end == NULL) {
 			break;
 		}
+		field = end + 1;
+	}
+}
+
+/**
+ * @brief	This routine materializes the words of a process into argv,
+ * 			expanding parameters and globs, and resolves its
+ * 			redirection targets.
+ *
+ * @return	0 on success, -1 if a substitution could not run.
+ */
+int cflow_expand(arena_t *arena, process_t *proc)
+{
+	int buffer_size = PSH_COMMAND_BUFSIZE;
+	int pos = 0;
+	int first_fd = g_cflow_nfds;
+	int failed = g_cflow_failed;
+	g_cflow_failed = 0;
+	char **token_arr = arena_alloc(arena, buffer_size * sizeof(char *));
+
+	int assigning = 1;
+
+	for (int w = 0; w < proc->nwords; w++) {
+		token_t *word = &proc->words[w];
+
+		// the value of a leading NAME=value is neither split nor globbed
+		if (assigning) {
+			const char *text = proc->line + word->offset;
+			const char *eq = memchr(text, '=', word->length);
+			assigning = eq != NULL && var_is_name(text, eq - text);
+		}
+		int flags = assigning ? 0 : word->flags;
+
+		// a substitution must run once, not once more for the literal
+		if ((flags & TOKEN_GLOB) && !(flags & TOKEN_SUBST)) {
+			char *pattern =
+				lexer_word(arena, proc->line, word, LEXER_GLOB_ESCAPE);
+			if (wildcard_expand(arena, pattern, &token_arr, &pos,
+								&buffer_size) > 0) {
+				continue;
+			}
+		}
+
+		if ((flags & (TOKEN_VAR | TOKEN_SUBST))) {
+			char *value =
+				lexer_word(arena, proc->line, word, LEXER_SPLIT_FIELDS);
+			cflow_add_fields(arena, &token_arr, &pos, &buffer_size, value,
+							 word->flags & TOKEN_QUOTED);
+			continue;
+		}
+
+		// keep a slot free for the terminating NULL
+		if (pos + 1 >= buffer_size) {
+			token_arr = arena_realloc(arena, token_arr,
+									  buffer_size * sizeof(char *),
+									  2 * buffer_size * sizeof(char *));
+			buffer_size *= 2;
+		}
+
+		token_arr[pos++] = lexer_word(arena, proc->line, word, 0);
+	}
+	token_arr[pos] = NULL;
+
+	proc->argv = token_arr;
+	proc->argc = pos;
+
+	if (proc->in_here == TOKEN_TLESS) {
+		char *word = lexer_word(arena, proc->line, proc->in_word, 0);
+		size_t len = strlen(word);
+		proc->in_path = arena_alloc(arena, len + 2);
+		memcpy(proc->in_path, word, len);
+		memcpy(proc->in_path + len, "\n", 2);
+	} else if (proc->in_here != 0) {
+		proc->in_path = lexer_heredoc(arena, proc->line, proc->in_word,
+									  proc->in_here == TOKEN_DLESSDASH
+										  ? LEXER_STRIP_TABS
+										  : 0);
+	} else if (proc->in_word != NULL) {
+		proc->in_path = lexer_word(arena, proc->line, proc->in_word, 0);
+	}
+	if (proc->out_word != NULL) {
+		proc->out_path = lexer_word(arena, proc->line, proc->out_word, 0);
 	}
 
-	for (i = argc; i <= pos; i++) {
-		token_arr[i] = NULL;
+	// a compound command keeps running its list, whatever it expands to
+	if (proc->type != COMMAND_COMPOUND) {
+		proc->type =
+			pos > 0 ? command_get_type(token_arr[0]) : COMMAND_BUILTIN;
 	}
 
-	process_t *new_proc = (process_t *)malloc(sizeof(process_t));
-	new_proc->cmd = cmd;
-	new_proc->argv = token_arr;
-	new_proc->argc = argc;
-	new_proc->in_path = in_path;
-	new_proc->out_path = out_path;
-	new_proc->pid = -1;
-	new_proc->type = command_get_type(token_arr[0]);
-	new_proc->next = NULL;
+	// a stage of nothing but NAME=value words sets shell variables
+	if (proc->type == COMMAND_EXTERNAL && var_is_assignment(token_arr[0])) {
+		int i = 1;
+		while (i < pos && var_is_assignment(token_arr[i])) {
+			i++;
+		}
+		if (i == pos) {
+			proc->type = COMMAND_ASSIGNMENT;
+		}
+	}
+
+	// the process owns the pipes of its process substitutions
+	if (g_cflow_nfds > first_fd) {
+		proc->nfds = g_cflow_nfds - first_fd;
+		proc->fds = arena_alloc(arena, proc->nfds * sizeof(int));
+		memcpy(proc->fds, g_cflow_fds + first_fd, proc->nfds * sizeof(int));
+		g_cflow_nfds = first_fd;
+	}
 
-	return new_proc;
+	int status = g_cflow_failed ? -1 : 0;
+	g_cflow_failed = failed;
+	return status;
 }
@@ -11,6 +11,91 @@
 
 #include "psh.h"
 
-process_t *cflow_parse(char *segment);
+/**
+ * @brief	How a node of a list depends on the status of the one before
+ */
+#define CFLOW_SEQ 0
+#define CFLOW_AND 1
+#define CFLOW_OR 2
+
+/**
+ * @brief	Kinds of node
+ */
+#define CFLOW_JOB 0
+#define CFLOW_IF 1
+#define CFLOW_WHILE 2
+#define CFLOW_UNTIL 3
+#define CFLOW_FOR 4
+#define CFLOW_CASE 5
+#define CFLOW_ITEM 6
+
+/**
+ * @brief	Size of a single read() of the output of a command
+ * 			substitution
+ */
+#define CFLOW_SUBST_CHUNK 65536
+
+/**
+ * @brief	A command of a command list, compiled once and run as is.
+ *
+ * 			CFLOW_JOB	job is a pipeline template owned by the node,
+ * 						every run gets its own copy of it.
+ * 			CFLOW_IF	runs body if cond succeeds, else alt.
+ * 			CFLOW_WHILE	runs body as long as cond succeeds,
+ * 			CFLOW_UNTIL	or fails.
+ * 			CFLOW_FOR	runs body with name set to each of words.
+ * 			CFLOW_CASE	runs the body of the first item, chained
+ * 						through alt, with words matching words[0].
+ *
+ * 			words are tokens of text, which the node owns.
+ */
+typedef struct cflow_node {
+	int type;
+	int op;
+	job_t *job;
+	struct cflow_node *cond;
+	struct cflow_node *body;
+	struct cflow_node *alt;
+	char *name;
+	char *text;
+	token_t *words;
+	int nwords;
+	struct cflow_node *next;
+} cflow_node_t;
+
+/**
+ * @brief	Nesting of a command gathered over several lines, kept so
+ * 			every line is only scanned once. scanned is where the
+ * 			next scan starts, depth counts open compound commands and
+ * 			parentheses, command whether a command may start at the
+ * 			next word, pattern whether case patterns come next and
+ * 			continued whether the text ended in '|', '&&' or '||'.
+ */
+typedef struct {
+	size_t scanned;
+	int depth;
+	int command;
+	int pattern;
+	int expect_in;
+	int redirect;
+	int continued;
+} cflow_nesting_t;
+
+job_t *cflow_parse_list(const char *line, token_t *tokens, int count,
+						int *incomplete);
+int cflow_is_list(const char *line, const token_t *tokens, int count);
+int cflow_is_keyword(const char *word);
+void cflow_nesting_init(cflow_nesting_t *nesting);
+int cflow_scan_nesting(cflow_nesting_t *nesting, const char *text);
+int cflow_run(cflow_node_t *node);
+int cflow_loop_control(int levels, int resume);
+char *cflow_substitute(arena_t *arena, const char *text, size_t len);
+char *cflow_process_subst(arena_t *arena, const char *text, size_t len,
+						  int output);
+void cflow_free(cflow_node_t *node);
+void cflow_expand_static(job_t *job);
+int cflow_parse(arena_t *arena, const char *line, token_t *tokens, int count,
+				process_t **proc);
+int cflow_expand(arena_t *arena, process_t *proc);
 
 #endif // __CFLOW_H_
@@ -13,72 +13,214 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
-#include "hashtable.h"
-#include "helper.h"
+#include "lexer.h"
 #include "command.h"
 #include "jobs.h"
 #include "cflow.h"
 #include "builtin.h"
+#include "pathcache.h"
+#include "parsecache.h"
+#include "variable.h"
+#include "psh.h"
 
 /**
- * @brief	This routine parses user input.
+ * @brief	Whether the last line parsed stopped in the middle of
+ * 			a command
+ */
+static int g_incomplete = 0;
+
+/**
+ * @brief	Whether the last line parsed had a syntax error
+ */
+static int g_malformed = 0;
+
+/**
+ * @brief	This routine reports a syntax error at a token.
+ */
+void command_syntax_error(const char *line, const token_t *token)
+{
+	g_malformed = 1;
+	if (token == NULL) {
+		fprintf(stderr, "psh: syntax error: unexpected end of line\n");
+	} else {
+		fprintf(stderr, "psh: syntax error near unexpected token `%.*s'\n",
+				(int)token->length, line + token->offset);
+	}
+}
+
+/**
+ * @brief	This routine checks if the last line parsed stopped in the
+ * 			middle of a command, an open quote, compound command or
+ * 			trailing operator, so it goes on on the next line.
+ *
+ * @return	1 if it did. Otherwise, 0.
+ */
+int command_is_incomplete(void)
+{
+	return g_incomplete;
+}
+
+/**
+ * @brief	This routine checks if the last line parsed had a syntax
+ * 			error, which has been reported.
+ *
+ * @return	1 if it had. Otherwise, 0.
+ */
+int command_is_malformed(void)
+{
+	return g_malformed;
+}
+
+/**
+ * @brief	This routine parses user input, going through the parse cache.
  * 
- * @return	Job structure
+ * @return	Job structure, or NULL if the line is empty or malformed.
  */
 job_t *command_parse(char *buffer)
 {
-	buffer = strtrim(buffer);
-	char *cmd = strdup(buffer);
+	job_t *job = parsecache_lookup(buffer);
+	if (job != NULL) {
+		return job;
+	}
+
+	job = command_parse_line(buffer);
+	if (job == NULL) {
+		return NULL;
+	}
+
+	return parsecache_insert(buffer, job);
+}
+
+/**
+ * @brief	This routine parses user input.
+ * 
+ * @return	Job structure, or NULL if the line is empty or malformed.
+ */
+job_t *command_parse_line(char *buffer)
+{
+	arena_t arena;
+	arena_init(&arena);
+
+	// the job owns the arena it is allocated from
+	job_t *new_job = arena_alloc(&arena, sizeof(job_t));
+	new_job->arena = arena;
+	new_job->refs = 1;
+	new_job->template = NULL;
+	new_job->root = NULL;
+
+	char *cmd = arena_strdup(&new_job->arena, buffer);
+	token_t *tokens;
+
+	g_incomplete = 0;
+	g_malformed = 0;
+
+	int count = lexer_scan(&new_job->arena, cmd, &tokens);
+	if (count == LEXER_INCOMPLETE) {
+		g_incomplete = 1;
+		job_free(new_job);
+		return NULL;
+	}
+
+	if (count > 0 && cflow_is_list(cmd, tokens, count)) {
+		int incomplete;
+		job_t *list = cflow_parse_list(cmd, tokens, count, &incomplete);
+		g_incomplete = incomplete;
+		job_free(new_job);
+		return list;
+	}
+
+	return command_parse_tokens(new_job, cmd, tokens, count);
+}
+
+/**
+ * @brief	This routine builds the processes of a pipeline from tokens
+ * 			scanned from cmd, which the job must own. The job is freed
+ * 			if they don't make up one.
+ *
+ * @return	Job structure, or NULL if the tokens are empty or malformed.
+ */
+job_t *command_parse_tokens(job_t *new_job, char *cmd, token_t *tokens,
+							int count)
+{
 	process_t *root_proc = NULL;
 	process_t *proc = NULL;
-	char *line_cur = buffer;
-	char *c = buffer;
-	char *seg;
-	int seg_len = 0;
 	int mode = FG_EXEC;
+	int timed = 0;
 
-	if (buffer[strlen(buffer) - 1] == '&') {
+	// 'time' is a keyword, only an unquoted one at the start counts
+	if (count > 0 && tokens[0].type == TOKEN_WORD &&
+		!(tokens[0].flags & TOKEN_QUOTED) && tokens[0].length == 4 &&
+		strncmp(cmd + tokens[0].offset, "time", 4) == 0) {
+		timed = 1;
+		tokens++;
+		count--;
+	}
+
+	if (count > 0 && tokens[count - 1].type == TOKEN_AMP) {
 		mode = BG_EXEC;
-		buffer[strlen(buffer) - 1] = '\0';
-	}
-
-	while (1) {
-		if (*c == '\0' || *c == '|') {
-			seg = (char *)malloc((seg_len + 1) * sizeof(char));
-			strncpy(seg, line_cur, seg_len);
-			seg[seg_len] = '\0';
-
-			process_t *new_proc = cflow_parse(seg);
-			if (!root_proc) {
-				root_proc = new_proc;
-				proc = root_proc;
-			} else {
-				proc->next = new_proc;
-				proc = new_proc;
-			}
+		count--;
+	}
 
-			if (*c != '\0') {
-				line_cur = c;
-				while (*(++line_cur) == ' ')
-					;
-				c = line_cur;
-				seg_len = 0;
-				continue;
-			} else {
-				break;
-			}
+	if (count == 0) {
+		if (mode == BG_EXEC) {
+			command_syntax_error(cmd, &tokens[0]);
+		}
+		job_free(new_job);
+		return NULL;
+	}
+
+	int pos = 0;
+	while (pos < count) {
+		process_t *new_proc;
+		int used = cflow_parse(&new_job->arena, cmd, tokens + pos,
+							   count - pos, &new_proc);
+		if (used < 0) {
+			command_syntax_error(cmd, &tokens[pos]);
+			job_free(new_job);
+			return NULL;
+		}
+
+		if (!root_proc) {
+			root_proc = new_proc;
+			proc = root_proc;
 		} else {
-			seg_len++;
-			c++;
+			proc->next = new_proc;
+			proc = new_proc;
+		}
+
+		pos += used;
+		if (pos < count) {
+			// only a pipe may separate stages, the next one may
+			// be on the next line
+			if (tokens[pos].type != TOKEN_PIPE) {
+				command_syntax_error(cmd, &tokens[pos]);
+				job_free(new_job);
+				return NULL;
+			}
+			if (pos + 1 == count) {
+				g_incomplete = mode == FG_EXEC;
+				if (mode == BG_EXEC) {
+					command_syntax_error(cmd, &tokens[count]);
+				}
+				job_free(new_job);
+				return NULL;
+			}
+			pos++;
 		}
 	}
 
-	job_t *new_job = (job_t *)malloc(sizeof(job_t));
+	new_job->id = -1;
 	new_job->root = root_proc;
 	new_job->cmd = cmd;
 	new_job->pgid = -1;
 	new_job->mode = mode;
+	new_job->timed = timed;
 
 	return new_job;
 }
@@ -90,16 +232,204 @@ job_t *command_parse(char *buffer)
  */
 int command_builtin(process_t *proc)
 {
-	builtin_func func = hashtable_search(g_builtin_hashtable, proc->argv[0]);
-	if (func == NULL) {
+	if (proc->type == COMMAND_COMPOUND) {
+		return cflow_run(proc->body);
+	}
+
+	if (proc->argc == 0) {
+		return 0;
+	}
+
+	if (proc->type == COMMAND_ASSIGNMENT) {
+		for (int i = 0; i < proc->argc; i++) {
+			var_assign(proc->argv[i], 0);
+		}
+
+		// expansion has just left the status of the last substitution
+		for (int i = 0; i < proc->nwords; i++) {
+			if (proc->words[i].flags & TOKEN_SUBST) {
+				return var_get_status();
+			}
+		}
+		return 0;
+	}
+
+	const builtin_t *builtin = builtin_lookup(proc->argv[0]);
+	if (builtin == NULL) {
 		return -255;
 	}
 
-	return func(proc);
+	return builtin->func(proc);
 }
 
 /**
- * @brief	This routine executes a supplied command.
+ * @brief	This routine launches an external command with posix_spawn(),
+ * 			which lets libc use vfork semantics instead of copying
+ * 			the shell's page tables.
+ * 
+ * @return	PID of the new process, or -1 on failure.
+ */
+static pid_t command_spawn(job_t *job, process_t *proc, const char *path,
+						   int in_fd, int out_fd)
+{
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_t actions;
+	sigset_t sigdefault;
+	pid_t pid;
+	char **envp = var_environ();
+
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setpgroup(&attr, job->pgid > 0 ? job->pgid : 0);
+	sigemptyset(&sigdefault);
+	sigaddset(&sigdefault, SIGINT);
+	sigaddset(&sigdefault, SIGTSTP);
+	posix_spawnattr_setsigdefault(&attr, &sigdefault);
+	posix_spawnattr_setflags(&attr,
+							 POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF);
+
+	posix_spawn_file_actions_init(&actions);
+	if (in_fd != 0) {
+		posix_spawn_file_actions_adddup2(&actions, in_fd, 0);
+	}
+	if (out_fd != 1) {
+		posix_spawn_file_actions_adddup2(&actions, out_fd, 1);
+	}
+	for (int i = 0; i < proc->nfds; i++) {
+		// onto itself, this only clears close-on-exec
+		posix_spawn_file_actions_adddup2(&actions, proc->fds[i],
+										 proc->fds[i]);
+	}
+
+	int err = posix_spawn(&pid, path, &actions, &attr, proc->argv, envp);
+	if (err == ENOENT && path != proc->argv[0]) {
+		// stale cache entry, the binary has moved
+		err = posix_spawnp(&pid, proc->argv[0], &actions, &attr, proc->argv,
+						   envp);
+	}
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	if (err != 0) {
+		fprintf(stderr, "psh: %s: %s\n", proc->argv[0], strerror(err));
+		return -1;
+	}
+
+	return pid;
+}
+
+/**
+ * @brief	This routine closes every descriptor above stderr in a
+ * 			forked child, except the ones of its process substitutions.
+ */
+static void command_close_fds(const process_t *proc)
+{
+	int max = 2;
+	for (int i = 0; i < proc->nfds; i++) {
+		if (proc->fds[i] > max) {
+			max = proc->fds[i];
+		}
+	}
+
+	for (int fd = 3; fd < max; fd++) {
+		int keep = 0;
+		for (int i = 0; i < proc->nfds; i++) {
+			keep |= proc->fds[i] == fd;
+		}
+		if (!keep) {
+			close(fd);
+		}
+	}
+
+	close_range(max + 1, ~0U, 0);
+}
+
+/**
+ * @brief	This routine launches a command with fork(). External
+ * 			commands are exec'ed from path, built-in commands
+ * 			run in the child itself so they don't hold up
+ * 			the rest of a pipeline.
+ * 
+ * @return	PID of the new process, or -1 on failure.
+ */
+static pid_t command_fork(job_t *job, process_t *proc, const char *path,
+						  int in_fd, int out_fd)
+{
+	char **envp = var_environ();
+	pid_t child_pid = fork();
+
+	if (child_pid < 0) {
+		return -1;
+	} else if (child_pid == 0) {
+		signal(SIGINT, SIG_DFL);
+		signal(SIGTSTP, SIG_DFL);
+
+		setpgid(0, job->pgid > 0 ? job->pgid : 0);
+
+		if (in_fd != 0) {
+			dup2(in_fd, 0);
+			close(in_fd);
+		}
+
+		if (out_fd != 1) {
+			dup2(out_fd, 1);
+			close(out_fd);
+		}
+
+		for (int i = 0; i < proc->nfds; i++) {
+			fcntl(proc->fds[i], F_SETFD, 0);
+		}
+
+		if (proc->type != COMMAND_EXTERNAL) {
+			// nothing will exec, so close-on-exec doesn't help here
+			command_close_fds(proc);
+			signal(SIGCHLD, SIG_DFL);
+			if (proc->type == COMMAND_COMPOUND) {
+				// a list runs its own jobs, without job control
+				shell->interactive = 0;
+				job_forget_all();
+			}
+			int status = command_builtin(proc);
+			fflush(stdout);
+			_exit(status & 0xff);
+		}
+
+		execve(path, proc->argv, envp);
+		if (errno == ENOENT && path != proc->argv[0]) {
+			// stale cache entry, the binary has moved
+			execvpe(proc->argv[0], proc->argv, envp);
+		}
+		perror(proc->argv[0]);
+		_exit(126);
+	}
+
+	// set the group from both sides so neither can race the other
+	setpgid(child_pid, job->pgid > 0 ? job->pgid : child_pid);
+
+	return child_pid;
+}
+
+/**
+ * @brief	This routine works out what the shell itself used since
+ * 			before was taken, for builtins that run inline.
+ */
+static void command_usage_since(const struct rusage *before,
+								struct rusage *usage)
+{
+	struct rusage now;
+	getrusage(RUSAGE_SELF, &now);
+
+	memset(usage, 0, sizeof(*usage));
+	timersub(&now.ru_utime, &before->ru_utime, &usage->ru_utime);
+	timersub(&now.ru_stime, &before->ru_stime, &usage->ru_stime);
+	usage->ru_maxrss = now.ru_maxrss;
+	usage->ru_nvcsw = now.ru_nvcsw - before->ru_nvcsw;
+	usage->ru_nivcsw = now.ru_nivcsw - before->ru_nivcsw;
+}
+
+/**
+ * @brief	This routine executes a supplied command. Processes it
+ * 			starts are left running, job_run() waits for them.
  * 
  * @return	Status
  */
@@ -109,72 +439,90 @@ int command_execute(job_t *job, process_t *proc, int in_fd, int out_fd,
 	int status = 0;
 	proc->status = STATUS_RUNNING;
 
-	if (proc->type == COMMAND_BUILTIN) {
-		int saved_stdout = dup(1);
-		int saved_stdin = dup(0);
+	if (job->timed) {
+		clock_gettime(CLOCK_MONOTONIC, &proc->start);
+	}
+
+	// only a foreground builtin at the end of its pipeline may change
+	// the shell itself, the others run alongside their neighbours
+	if (proc->type != COMMAND_EXTERNAL && mode == FG_EXEC) {
+		// close-on-exec, so commands the builtin starts don't see them;
+		// the builtins of a loop mostly need neither
+		int saved_stdout = -1;
+		int saved_stdin = -1;
 
 		if (in_fd != 0) {
+			saved_stdin = fcntl(0, F_DUPFD_CLOEXEC, 0);
 			dup2(in_fd, 0);
-			close(in_fd);
 		}
 
 		if (out_fd != 1) {
+			saved_stdout = fcntl(1, F_DUPFD_CLOEXEC, 0);
+			fflush(stdout);
 			dup2(out_fd, 1);
-			close(out_fd);
 		}
 
-		status = command_builtin(proc);
+		if (job->timed) {
+			struct rusage before;
+			getrusage(RUSAGE_SELF, &before);
+			status = command_builtin(proc);
+			command_usage_since(&before, &proc->usage);
+			clock_gettime(CLOCK_MONOTONIC, &proc->end);
+		} else {
+			status = command_builtin(proc);
+		}
+		proc->status = STATUS_DONE;
+		proc->exit_code = status & 0xff;
+
+		// the output belongs to the redirected fd, not the restored one
+		if (out_fd != 1) {
+			fflush(stdout);
+			dup2(saved_stdout, 1);
+			close(saved_stdout);
+		}
 
-		dup2(saved_stdout, 1);
-		close(saved_stdout);
-		dup2(saved_stdin, 0);
-		close(saved_stdin);
+		if (in_fd != 0) {
+			dup2(saved_stdin, 0);
+			close(saved_stdin);
+		}
 	} else {
-		pid_t child_pid = fork();
-
-		if (child_pid < 0) {
-			return -1;
-		} else if (child_pid == 0) {
-			signal(SIGINT, SIG_DFL);
-
-			proc->pid = getpid();
-			if (job->pgid > 0) {
-				setpgid(0, job->pgid);
-			} else {
-				job->pgid = proc->pid;
-				setpgid(0, job->pgid);
-			}
+		const char *path = NULL;
+		pid_t child_pid = -1;
 
-			if (in_fd != 0) {
-				dup2(in_fd, 0);
-				close(in_fd);
-			}
+		// resolve in the parent so the result stays cached
+		if (proc->type == COMMAND_EXTERNAL) {
+			path = pathcache_lookup(proc->argv[0]);
+		}
 
-			if (out_fd != 1) {
-				dup2(out_fd, 1);
-				close(out_fd);
-			}
+		// keep our buffered output ahead of the child's
+		fflush(stdout);
 
-			if (execvp(proc->argv[0], proc->argv) < 0) {
-				perror(proc->argv[0]);
-				exit(1);
+		if (proc->type == COMMAND_EXTERNAL && path == NULL) {
+			fprintf(stderr, "psh: %s: command not found\n", proc->argv[0]);
+			proc->status = STATUS_DONE;
+			status = 127;
+			proc->exit_code = status;
+		} else if (proc->type == COMMAND_EXTERNAL &&
+				   (shell->options & OPTION_POSIX_SPAWN)) {
+			child_pid = command_spawn(job, proc, path, in_fd, out_fd);
+			if (child_pid < 0) {
+				proc->status = STATUS_DONE;
+				status = 126;
+				proc->exit_code = status;
 			}
 		} else {
-			proc->pid = child_pid;
-			if (job->pgid > 0) {
-				setpgid(child_pid, job->pgid);
-			} else {
-				job->pgid = proc->pid;
-				setpgid(child_pid, job->pgid);
+			child_pid = command_fork(job, proc, path, in_fd, out_fd);
+			if (child_pid < 0) {
+				return -1;
 			}
+		}
 
-			if (mode == FG_EXEC) {
-				tcsetpgrp(0, job->pgid);
-				status = job_wait(job->id);
-				signal(SIGTTOU, SIG_IGN);
-				tcsetpgrp(0, getpid());
-				signal(SIGTTOU, SIG_DFL);
+		if (child_pid > 0) {
+			proc->pid = child_pid;
+			if (job->pgid <= 0) {
+				job->pgid = child_pid;
 			}
+			job_add_pid(job, proc);
 		}
 	}
 
@@ -188,8 +536,7 @@ int command_execute(job_t *job, process_t *proc, int in_fd, int out_fd,
  */
 int command_get_type(char *command)
 {
-	builtin_func func = hashtable_search(g_builtin_hashtable, command);
-	if (func == NULL) {
+	if (builtin_lookup(command) == NULL) {
 		return COMMAND_EXTERNAL;
 	}
 
@@ -16,6 +16,12 @@
 
 #define COMMAND_BUILTIN 0
 #define COMMAND_EXTERNAL 1
+#define COMMAND_ASSIGNMENT 2
+/**
+ * @brief	A command list run by the shell itself, or by a
+ * 			forked copy of it in a pipeline or the background
+ */
+#define COMMAND_COMPOUND 3
 
 /**
  * @brief	Buffer size for user input tokenization
@@ -23,6 +29,12 @@
 #define PSH_COMMAND_BUFSIZE 64
 
 job_t *command_parse(char *buffer);
+job_t *command_parse_line(char *buffer);
+job_t *command_parse_tokens(job_t *job, char *cmd, token_t *tokens,
+							int count);
+int command_is_incomplete(void);
+int command_is_malformed(void);
+void command_syntax_error(const char *line, const token_t *token);
 int command_builtin(process_t *proc);
 int command_execute(job_t *job, process_t *proc, int in_fd, int out_fd,
 					int mode);
@@ -1,38 +1,54 @@
 /**
- * @file:		src/hashtable.h
+ * @file:		src/hashtable.c
  * @author:		Jozef Nagy <schkwve@gmail.com>
  * @copyright:	MIT (See LICENSE.md)
  * @brief:		This file contains the routines for
- * 				hashtable lookup for built-in commands.
+ * 				string-keyed hashtable lookup.
  */
 
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <math.h>
+#include <stdint.h>
 
 #include "hashtable.h"
-#include "builtin.h"
 
-static hashtable_entry_t HASHTABLE_REMOVED_ENTRY = { NULL, NULL };
+/**
+ * @brief	Key of a slot whose entry has been removed. Probes continue
+ * 			past it, inserts may reuse it.
+ */
+static char HASHTABLE_TOMBSTONE[1];
 
 /**
- * @brief	This routine hashes a key.
- * 
+ * @brief	This routine allocates a zeroed slot array.
+ */
+static hashtable_entry_t *hashtable_alloc_slots(size_t size)
+{
+	hashtable_entry_t *entry = calloc(size, sizeof(hashtable_entry_t));
+	if (entry == NULL) {
+		perror("psh");
+		exit(1);
+	}
+
+	return entry;
+}
+
+/**
+ * @brief	This routine hashes a key with 32-bit FNV-1a.
+ *
  * @return	Hash
  */
-static int hash(const char *key, const int a, const size_t size)
+uint32_t hashtable_hash(const char *key)
 {
-	uint64_t hash = 0;
-	const size_t keylen = strlen(key);
+	uint32_t hash = 2166136261u;
 
-	for (size_t i = 0; i < keylen; i++) {
-		hash += (uint64_t)pow(a, keylen - (i + 1)) * key[i];
-		hash = hash % size;
+	while (*key != '\0') {
+		hash ^= (unsigned char)*key++;
+		hash *= 16777619u;
 	}
 
-	return (int)hash;
+	return hash;
 }
 
 /**
@@ -42,26 +58,32 @@ static int hash(const char *key, const int a, const size_t size)
 hashtable_t *hashtable_create(void)
 {
 	hashtable_t *hashtable = malloc(sizeof(*hashtable));
+	if (hashtable == NULL) {
+		perror("psh");
+		exit(1);
+	}
 
-	// 41 is the answer.
-	hashtable->size = 41;
+	hashtable->size = HASHTABLE_INITIAL_SIZE;
 	hashtable->count = 0;
-	hashtable->entry = calloc(hashtable->size, sizeof(hashtable_entry_t *));
+	hashtable->used = 0;
+	hashtable->entry = hashtable_alloc_slots(hashtable->size);
 
 	return hashtable;
 }
 
 /**
  * @brief	This routine removes all entries from a hashtable and
- * 			free()'s it.
+ * 			free()'s it. Values belong to the caller.
  */
 void hashtable_destroy(hashtable_t *hashtable)
 {
+	if (hashtable == NULL) {
+		return;
+	}
+
 	for (size_t i = 0; i < hashtable->size; i++) {
-		hashtable_entry_t *entry = hashtable->entry[i];
-		if (entry != NULL) {
-			free(entry->key);
-			free(entry);
+		if (hashtable->entry[i].key != HASHTABLE_TOMBSTONE) {
+			free(hashtable->entry[i].key);
 		}
 	}
 
@@ -69,105 +91,162 @@ void hashtable_destroy(hashtable_t *hashtable)
 	free(hashtable);
 }
 
-
 /**
- * @brief	This routine inserts an entry into a hashtable.
+ * @brief	This routine finds the slot of a key.
+ *
+ * @return	Slot holding key, or NULL if it isn't in the table.
  */
-void hashtable_insert(hashtable_t *hashtable, const char *key,
-					  builtin_func func_ptr)
+static hashtable_entry_t *hashtable_find(hashtable_t *hashtable,
+										 const char *key, uint32_t hash)
 {
-	hashtable_entry_t *entry = hashtable_new_entry(key, func_ptr);
-	int index = hashtable_get_hash(entry->key, hashtable->size, 0);
-	hashtable_entry_t *cur = hashtable->entry[index];
-	int i = 1;
-	while (cur != NULL) {
-		if (cur != &HASHTABLE_REMOVED_ENTRY) {
-			if (strncmp(cur->key, key, strlen(key)) == 0) {
-				free(cur->key);
-				free(cur);
-				hashtable->entry[index] = entry;
-				return;
-			}
-			index = hashtable_get_hash(entry->key, hashtable->size, i);
-			cur = hashtable->entry[index];
-			i++;
+	size_t mask = hashtable->size - 1;
+	size_t i = hash & mask;
+
+	while (hashtable->entry[i].key != NULL) {
+		hashtable_entry_t *entry = &hashtable->entry[i];
+		if (entry->hash == hash && entry->key != HASHTABLE_TOMBSTONE &&
+			strcmp(entry->key, key) == 0) {
+			return entry;
 		}
+		i = (i + 1) & mask;
 	}
-	hashtable->entry[index] = entry;
-	hashtable->count++;
+
+	return NULL;
 }
 
 /**
- * @brief	This routine creates an hashtable entry
+ * @brief	This routine moves every live entry into a table of
+ * 			size slots, dropping all tombstones on the way.
  */
-hashtable_entry_t *hashtable_new_entry(const char *key, builtin_func func_ptr)
+static void hashtable_rehash(hashtable_t *hashtable, size_t size)
 {
-	if (key == NULL || func_ptr == NULL) {
-		return NULL;
-	}
+	hashtable_entry_t *old = hashtable->entry;
+	size_t old_size = hashtable->size;
+	size_t mask = size - 1;
 
-	hashtable_entry_t *entry = malloc(sizeof(hashtable_entry_t));
-	entry->key = strdup(key);
-	entry->func_ptr = func_ptr;
+	hashtable->entry = hashtable_alloc_slots(size);
+	hashtable->size = size;
+	hashtable->used = hashtable->count;
 
-	return entry;
+	for (size_t i = 0; i < old_size; i++) {
+		if (old[i].key == NULL || old[i].key == HASHTABLE_TOMBSTONE) {
+			continue;
+		}
+
+		size_t slot = old[i].hash & mask;
+		while (hashtable->entry[slot].key != NULL) {
+			slot = (slot + 1) & mask;
+		}
+		hashtable->entry[slot] = old[i];
+	}
+
+	free(old);
 }
 
 /**
- * @brief	This routine removes an entry from a hashtable.
+ * @brief	This routine inserts an entry into a hashtable, replacing
+ * 			the value of an existing key.
+ *
+ * @return	Previous value of key, or NULL if it is new.
  */
-void hashtable_remove_entry(hashtable_t *hashtable, const char *key)
+void *hashtable_insert(hashtable_t *hashtable, const char *key, void *value)
 {
-	int index = hashtable_get_hash(key, hashtable->size, 0);
-	hashtable_entry_t *entry = hashtable->entry[index];
-	int i = 1;
-	while (entry != NULL) {
-		if (entry != &HASHTABLE_REMOVED_ENTRY) {
-			if (strcmp(entry->key, key) == 0) {
-				free(entry->key);
-				free(entry);
-				hashtable->entry[index] = &HASHTABLE_REMOVED_ENTRY;
-			}
+	uint32_t hash = hashtable_hash(key);
+
+	hashtable_entry_t *entry = hashtable_find(hashtable, key, hash);
+	if (entry != NULL) {
+		void *old_value = entry->value;
+		entry->value = value;
+		return old_value;
+	}
+
+	// keep at least a quarter of the slots empty so probes terminate
+	// quickly; if tombstones are what fills it, a same-size rehash will do
+	if ((hashtable->used + 1) * 4 > hashtable->size * 3) {
+		size_t size = hashtable->size;
+		if ((hashtable->count + 1) * 2 > size) {
+			size *= 2;
 		}
-		index = hashtable_get_hash(key, hashtable->size, i);
-		entry = hashtable->entry[index];
-		i++;
+		hashtable_rehash(hashtable, size);
 	}
-	hashtable->count--;
+
+	size_t mask = hashtable->size - 1;
+	size_t i = hash & mask;
+	while (hashtable->entry[i].key != NULL &&
+		   hashtable->entry[i].key != HASHTABLE_TOMBSTONE) {
+		i = (i + 1) & mask;
+	}
+
+	entry = &hashtable->entry[i];
+	if (entry->key == NULL) {
+		hashtable->used++;
+	}
+
+	entry->key = strdup(key);
+	entry->value = value;
+	entry->hash = hash;
+	hashtable->count++;
+
+	return NULL;
 }
 
 /**
  * @brief	This routine searches for a key in a hashtable.
+ *
+ * @return	Value of key, or NULL if it isn't in the table.
  */
-builtin_func hashtable_search(hashtable_t *hashtable, const char *key)
+void *hashtable_search(hashtable_t *hashtable, const char *key)
 {
-	int index = hashtable_get_hash(key, hashtable->size, 0);
-	hashtable_entry_t *entry = hashtable->entry[index];
-
-	int attempt = 1;
-	while (entry != NULL) {
-		if (entry != &HASHTABLE_REMOVED_ENTRY) {
-			if (strncmp(entry->key, key, strlen(key)) == 0) {
-				return entry->func_ptr;
-			}
-			index = hashtable_get_hash(key, hashtable->size, attempt);
-			entry = hashtable->entry[index];
-			attempt++;
-		}
+	hashtable_entry_t *entry =
+		hashtable_find(hashtable, key, hashtable_hash(key));
+
+	return entry != NULL ? entry->value : NULL;
+}
+
+/**
+ * @brief	This routine removes an entry from a hashtable.
+ *
+ * @return	Value of the removed key, or NULL if it wasn't in the table.
+ */
+void *hashtable_remove(hashtable_t *hashtable, const char *key)
+{
+	hashtable_entry_t *entry =
+		hashtable_find(hashtable, key, hashtable_hash(key));
+	if (entry == NULL) {
+		return NULL;
 	}
 
-	return NULL;
+	void *value = entry->value;
+
+	free(entry->key);
+	entry->key = HASHTABLE_TOMBSTONE;
+	entry->value = NULL;
+	hashtable->count--;
+
+	// an empty table can forget its tombstones for free
+	if (hashtable->count == 0) {
+		memset(hashtable->entry, 0, hashtable->size * sizeof(hashtable_entry_t));
+		hashtable->used = 0;
+	}
+
+	return value;
 }
 
 /**
- * @brief	This routine calculates the hash of a key
- * 			with basic collision mitigation
+ * @brief	This routine iterates over the live entries of a hashtable.
+ * 			*pos must start at 0. The table must not be modified
+ * 			while iterating.
+ *
+ * @return	Next entry, or NULL once every entry has been visited.
  */
-int hashtable_get_hash(const char *key, const size_t hashmap_size,
-					   const int att)
+hashtable_entry_t *hashtable_next(hashtable_t *hashtable, size_t *pos)
 {
-	const int a = hash(key, 151, hashmap_size);
-	const int b = hash(key, 163, hashmap_size);
+	while (*pos < hashtable->size) {
+		hashtable_entry_t *entry = &hashtable->entry[(*pos)++];
+		if (entry->key != NULL && entry->key != HASHTABLE_TOMBSTONE) {
+			return entry;
+		}
+	}
 
-	return (a + (att * (b + 1))) % hashmap_size;
+	return NULL;
 }
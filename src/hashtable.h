@@ -3,38 +3,44 @@
  * @author:		Jozef Nagy <schkwve@gmail.com>
  * @copyright:	MIT (See LICENSE.md)
  * @brief:		This file contains the routines for
- * 				hashtable lookup for built-in commands.
+ * 				string-keyed hashtable lookup.
  */
 
 #ifndef __HASHTABLE_H_
 #define __HASHTABLE_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
-#include "builtin.h"
+/**
+ * @brief	Number of slots of a new hashtable, always a power of two
+ */
+#define HASHTABLE_INITIAL_SIZE 16
 
 typedef struct {
 	char *key;
-	builtin_func func_ptr;
+	void *value;
+	uint32_t hash;
 } hashtable_entry_t;
 
+/**
+ * @brief	Open-addressed, linearly probed table. used counts live
+ * 			entries plus tombstones, which is what lengthens probes.
+ */
 typedef struct {
 	size_t size;
 	size_t count;
-	hashtable_entry_t **entry;
+	size_t used;
+	hashtable_entry_t *entry;
 } hashtable_t;
 
-extern hashtable_t *g_builtin_hashtable;
-
 hashtable_t *hashtable_create(void);
 void hashtable_destroy(hashtable_t *hashtable);
 
-void hashtable_insert(hashtable_t *hashtable, const char *key,
-					  builtin_func func_ptr);
-hashtable_entry_t *hashtable_new_entry(const char *key, builtin_func func_ptr);
-builtin_func hashtable_search(hashtable_t *hashtable, const char *key);
-int hashtable_get_hash(const char *key, const size_t hashmap_size,
-					   const int att);
-void hashtable_remove_entry(hashtable_t *hashtable, const char *key);
+void *hashtable_insert(hashtable_t *hashtable, const char *key, void *value);
+void *hashtable_search(hashtable_t *hashtable, const char *key);
+void *hashtable_remove(hashtable_t *hashtable, const char *key);
+hashtable_entry_t *hashtable_next(hashtable_t *hashtable, size_t *pos);
+uint32_t hashtable_hash(const char *key);
 
 #endif // __HASHTABLE_H_
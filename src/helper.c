@@ -7,25 +7,26 @@
  */
 
 #include <string.h>
+#include <ctype.h>
 
 #include "helper.h"
 
 /**
- * @brief	This routine trims excessive whitespace
- * 			"  Hello   World" -> "Hello World"
+ * @brief	This routine trims leading and trailing whitespace
+ * 			"  Hello World\n" -> "Hello World"
  */
 char *strtrim(char *str)
 {
 	char *head = str;
 	char *tail = str + strlen(str);
 
-	while (*head == ' ') {
+	while (*head == ' ' || *head == '\t') {
 		head++;
 	}
-	while (*tail == ' ') {
+	while (tail > head && isspace((unsigned char)tail[-1])) {
 		tail--;
 	}
-	*(tail - 1) = '\0';
+	*tail = '\0';
 
 	return head;
 }
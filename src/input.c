@@ -0,0 +1,244 @@
+/**
+ * @file:		src/input.c
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains the routines for
+ * 				reading command lines from a terminal or script.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "input.h"
+
+/**
+ * @brief	This routine prepares fd for line reading. Regular files
+ * 			are mapped whole, everything else is read in large blocks.
+ * 			A mapped stdin is shared with the commands it runs, so its
+ * 			offset is kept at the next unread line. A stdin pipe can't
+ * 			be given back, so it is read no further than a line.
+ *
+ * @return	Input structure
+ */
+input_t *input_open(int fd)
+{
+	input_t *input = calloc(1, sizeof(input_t));
+	if (input == NULL) {
+		perror("psh");
+		exit(1);
+	}
+
+	input->fd = fd;
+	input->event_fd = -1;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		off_t offset = lseek(fd, 0, SEEK_CUR);
+		if (offset < 0) {
+			offset = 0;
+		}
+
+		// private writable mapping: lines are NUL-terminated in place
+		void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+						 MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			input->data = map;
+			input->size = st.st_size;
+			input->pos = offset;
+			input->mapped = 1;
+			input->shared = fd == 0;
+			input->eof = 1;
+			return input;
+		}
+	}
+
+	input->bytewise = fd == 0 && !isatty(fd) && lseek(fd, 0, SEEK_CUR) < 0;
+	input->capacity = INPUT_BLOCK_SIZE;
+	input->data = malloc(input->capacity);
+	if (input->data == NULL) {
+		perror("psh");
+		exit(1);
+	}
+
+	return input;
+}
+
+/**
+ * @brief	This routine makes reads wait on fd as well. Whenever fd
+ * 			becomes readable while waiting for input, handler is called.
+ */
+void input_set_event(input_t *input, int fd, void (*handler)(void))
+{
+	input->event_fd = fd;
+	input->event_handler = handler;
+}
+
+/**
+ * @brief	This routine sleeps until the input is readable, dispatching
+ * 			events that arrive in the meantime.
+ */
+static void input_wait(input_t *input)
+{
+	struct pollfd fds[2] = {
+		{ .fd = input->fd, .events = POLLIN },
+		{ .fd = input->event_fd, .events = POLLIN },
+	};
+
+	for (;;) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+
+		if (fds[1].revents & POLLIN) {
+			input->event_handler();
+		}
+
+		if (fds[0].revents) {
+			return;
+		}
+	}
+}
+
+/**
+ * @brief	This routine reads another block from a non-mapped input,
+ * 			discarding already consumed lines first.
+ *
+ * @return	Number of bytes read, 0 on EOF.
+ */
+static ssize_t input_fill(input_t *input)
+{
+	if (input->pos > 0) {
+		input->size -= input->pos;
+		memmove(input->data, input->data + input->pos, input->size);
+		input->pos = 0;
+	}
+
+	if (input->capacity - input->size < INPUT_BLOCK_SIZE / 2) {
+		input->capacity *= 2;
+		input->data = realloc(input->data, input->capacity);
+		if (input->data == NULL) {
+			perror("psh");
+			exit(1);
+		}
+	}
+
+	if (input->event_fd >= 0) {
+		input_wait(input);
+	}
+
+	ssize_t len;
+	do {
+		len = read(input->fd, input->data + input->size,
+				   input->bytewise ? 1 : input->capacity - input->size - 1);
+	} while (len < 0 && errno == EINTR);
+
+	// the bytes after the newline are for the commands of this line
+	if (input->bytewise && len > 0) {
+		size_t got = len;
+		while (input->data[input->size + got - 1] != '\n' &&
+			   input->size + got + 1 < input->capacity) {
+			len = read(input->fd, input->data + input->size + got, 1);
+			if (len < 0 && errno == EINTR) {
+				continue;
+			}
+			if (len <= 0) {
+				break;
+			}
+			got++;
+		}
+		len = got;
+	}
+
+	if (len <= 0) {
+		input->eof = 1;
+		return 0;
+	}
+
+	input->size += len;
+	return len;
+}
+
+/**
+ * @brief	This routine returns the next line without its newline.
+ * 			The line is modifiable and stays valid until the next call.
+ *
+ * @return	Line, or NULL on EOF.
+ */
+char *input_next_line(input_t *input)
+{
+	// pick up after whatever the last command read from stdin
+	if (input->shared) {
+		off_t offset = lseek(input->fd, 0, SEEK_CUR);
+		if (offset >= (off_t)input->pos && offset <= (off_t)input->size) {
+			input->pos = offset;
+		}
+	}
+
+	for (;;) {
+		char *line = input->data + input->pos;
+		size_t left = input->size - input->pos;
+		char *newline = memchr(line, '\n', left);
+
+		if (newline != NULL) {
+			*newline = '\0';
+			input->pos += newline - line + 1;
+			if (input->shared) {
+				lseek(input->fd, input->pos, SEEK_SET);
+			}
+			return line;
+		}
+
+		if (!input->eof) {
+			input_fill(input);
+			continue;
+		}
+
+		if (left == 0) {
+			return NULL;
+		}
+
+		input->pos = input->size;
+		if (input->shared) {
+			lseek(input->fd, input->pos, SEEK_SET);
+		}
+
+		// a mapping has no room for the terminator of the last line
+		if (input->mapped) {
+			free(input->tail);
+			input->tail = strndup(line, left);
+			return input->tail;
+		}
+
+		line[left] = '\0';
+		return line;
+	}
+}
+
+/**
+ * @brief	This routine releases an input and everything it holds.
+ */
+void input_close(input_t *input)
+{
+	if (input == NULL) {
+		return;
+	}
+
+	if (input->mapped) {
+		munmap(input->data, input->size);
+	} else {
+		free(input->data);
+	}
+
+	free(input->tail);
+	free(input);
+}
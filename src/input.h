@@ -0,0 +1,39 @@
+/**
+ * @file:		src/input.h
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains the routines for
+ * 				reading command lines from a terminal or script.
+ */
+
+#ifndef __INPUT_H_
+#define __INPUT_H_
+
+#include <stddef.h>
+
+/**
+ * @brief	Size of a single read() for non-mappable input
+ */
+#define INPUT_BLOCK_SIZE 65536
+
+typedef struct {
+	int fd;
+	char *data;
+	size_t size;
+	size_t capacity;
+	size_t pos;
+	char *tail;
+	int mapped;
+	int shared;
+	int bytewise;
+	int eof;
+	int event_fd;
+	void (*event_handler)(void);
+} input_t;
+
+input_t *input_open(int fd);
+void input_set_event(input_t *input, int fd, void (*handler)(void));
+char *input_next_line(input_t *input);
+void input_close(input_t *input);
+
+#endif // __INPUT_H_
@@ -10,30 +10,235 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
 #include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/pidfd.h>
 
+#include "builtin.h"
 #include "command.h"
+#include "cflow.h"
 #include "jobs.h"
+#include "variable.h"
 #include "psh.h"
 
 const char *g_proc_status[] = { "running", "done", "suspended", "continued",
 								"terminated" };
 
 /**
- * @brief	This routine find a valid and free job ID.
+ * @brief	Entry of the PID index, mapping a PID back to its job and process
+ */
+typedef struct {
+	pid_t pid;
+	int pidfd;
+	job_t *job;
+	process_t *proc;
+} job_pid_entry_t;
+
+/**
+ * @brief	Open-addressed PID index, sized to a power of two.
+ * 			A PID of 0 marks a free slot.
+ */
+static job_pid_entry_t *g_pid_index = NULL;
+static size_t g_pid_index_size = 0;
+static size_t g_pid_index_count = 0;
+
+/**
+ * @brief	Self-pipe the SIGCHLD handler writes to, so a shell waiting
+ * 			for input wakes up to reap finished jobs.
+ */
+static int g_sigchld_pipe[2] = { -1, -1 };
+
+/**
+ * @brief	epoll instance holding a pidfd for every watched process,
+ * 			so waiting for many jobs costs nothing per job on wakeup.
+ * 			Without pidfd support, waits fall back to wait4(-1).
+ */
+static int g_epoll_fd = -1;
+static int g_pidfd_support = 1;
+
+static int g_job_count = 0;
+
+/**
+ * @brief	Number of jobs that finished while the shell was waiting for
+ * 			others. They stay in the table until waited for or reported.
+ */
+static int g_job_unreported = 0;
+
+/**
+ * @brief	This routine hashes a PID into the index.
+ * 
+ * @return	Slot to start probing at
+ */
+static size_t job_pid_hash(pid_t pid)
+{
+	return ((uint32_t)pid * 2654435761u) & (g_pid_index_size - 1);
+}
+
+/**
+ * @brief	This routine finds the index entry of a PID.
+ * 
+ * @return	Entry, or NULL if the PID doesn't belong to any job.
+ */
+static job_pid_entry_t *job_pid_lookup(pid_t pid)
+{
+	if (g_pid_index_count == 0 || pid <= 0) {
+		return NULL;
+	}
+
+	size_t i = job_pid_hash(pid);
+	while (g_pid_index[i].pid != 0) {
+		if (g_pid_index[i].pid == pid) {
+			return &g_pid_index[i];
+		}
+		i = (i + 1) & (g_pid_index_size - 1);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief	This routine doubles the PID index and rehashes it.
+ */
+static void job_pid_grow(void)
+{
+	job_pid_entry_t *old = g_pid_index;
+	size_t old_size = g_pid_index_size;
+
+	g_pid_index_size = old_size ? old_size * 2 : JOB_TABLE_SIZE * 4;
+	g_pid_index = calloc(g_pid_index_size, sizeof(job_pid_entry_t));
+	if (g_pid_index == NULL) {
+		perror("psh");
+		exit(1);
+	}
+
+	for (size_t i = 0; i < old_size; i++) {
+		if (old[i].pid != 0) {
+			size_t j = job_pid_hash(old[i].pid);
+			while (g_pid_index[j].pid != 0) {
+				j = (j + 1) & (g_pid_index_size - 1);
+			}
+			g_pid_index[j] = old[i];
+		}
+	}
+
+	free(old);
+}
+
+/**
+ * @brief	This routine drops a PID from the index, shifting back
+ * 			the entries behind it so no tombstones are needed.
+ */
+static void job_pid_drop(pid_t pid)
+{
+	job_pid_entry_t *entry = job_pid_lookup(pid);
+	if (entry == NULL) {
+		return;
+	}
+
+	if (entry->pidfd >= 0) {
+		close(entry->pidfd);
+	}
+
+	size_t mask = g_pid_index_size - 1;
+	size_t hole = entry - g_pid_index;
+	size_t i = (hole + 1) & mask;
+
+	while (g_pid_index[i].pid != 0) {
+		size_t home = job_pid_hash(g_pid_index[i].pid);
+		// move the entry if the hole lies between its home slot and it
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			g_pid_index[hole] = g_pid_index[i];
+			hole = i;
+		}
+		i = (i + 1) & mask;
+	}
+
+	g_pid_index[hole].pid = 0;
+	g_pid_index_count--;
+}
+
+/**
+ * @brief	This routine records the PID of a freshly launched process.
+ * 
+ * @return	0 on success. Otherwise, -1.
+ */
+int job_add_pid(job_t *job, process_t *proc)
+{
+	if (proc->pid <= 0) {
+		return -1;
+	}
+
+	if ((g_pid_index_count + 1) * 2 > g_pid_index_size) {
+		job_pid_grow();
+	}
+
+	size_t i = job_pid_hash(proc->pid);
+	while (g_pid_index[i].pid != 0 && g_pid_index[i].pid != proc->pid) {
+		i = (i + 1) & (g_pid_index_size - 1);
+	}
+
+	if (g_pid_index[i].pid == 0) {
+		g_pid_index_count++;
+		g_pid_index[i].pidfd = -1;
+	}
+
+	g_pid_index[i].pid = proc->pid;
+	g_pid_index[i].job = job;
+	g_pid_index[i].proc = proc;
+
+	return 0;
+}
+
+/**
+ * @brief	This routine looks up a job by its ID.
+ * 
+ * @return	Job, or NULL if the ID is invalid or the job doesn't exist.
+ */
+job_t *job_get(int id)
+{
+	if (id <= 0 || id >= shell->job_capacity) {
+		return NULL;
+	}
+
+	return shell->jobs[id];
+}
+
+/**
+ * @brief	This routine finds a valid and free job ID,
+ * 			growing the job table when it is full.
  * 
  * @return	Job ID if a free one was found. Otherwise, -1.
  */
 int job_get_next_id(void)
 {
-	for (int i = 0; i <= MAX_JOBS; i++) {
-		if (shell->jobs[i] == NULL) {
-			return i;
+	int id = shell->job_max + 1;
+
+	if (id >= shell->job_capacity) {
+		int capacity = shell->job_capacity ? shell->job_capacity * 2
+										   : JOB_TABLE_SIZE;
+		job_t **jobs = realloc(shell->jobs, capacity * sizeof(job_t *));
+		if (jobs == NULL) {
+			return -1;
 		}
+
+		for (int i = shell->job_capacity; i < capacity; i++) {
+			jobs[i] = NULL;
+		}
+		shell->jobs = jobs;
+		shell->job_capacity = capacity;
 	}
 
-	return -1;
+	return id;
 }
 
 /**
@@ -43,14 +248,15 @@ int job_get_next_id(void)
  */
 int job_print_proc(int id)
 {
-	if (id > MAX_JOBS || shell->jobs[id] == NULL) {
+	job_t *job = job_get(id);
+	if (job == NULL) {
 		return -1;
 	}
 
 	printf("[%d]", id);
 
 	process_t *proc;
-	for (proc = shell->jobs[id]->root; proc != NULL; proc = proc->next) {
+	for (proc = job->root; proc != NULL; proc = proc->next) {
 		printf(" %d", proc->pid);
 	}
 	printf("\n");
@@ -65,16 +271,17 @@ int job_print_proc(int id)
  */
 int job_print_status(int id)
 {
-	if (id > MAX_JOBS || shell->jobs[id] == NULL) {
+	job_t *job = job_get(id);
+	if (job == NULL) {
 		return -1;
 	}
 
 	printf("[%d]", id);
 
 	process_t *proc;
-	for (proc = shell->jobs[id]->root; proc != NULL; proc = proc->next) {
-		printf("\t%d\t%s\t%s", proc->pid, g_proc_status[proc->status],
-			   proc->cmd);
+	for (proc = job->root; proc != NULL; proc = proc->next) {
+		printf("\t%d\t%s\t%.*s", proc->pid, g_proc_status[proc->status],
+			   proc->cmd_len, proc->cmd);
 		if (proc->next != NULL) {
 			printf("|\n");
 		} else {
@@ -85,6 +292,111 @@ int job_print_status(int id)
 	return 0;
 }
 
+/**
+ * @brief	This routine converts a timespec difference to seconds.
+ *
+ * @return	Seconds
+ */
+static double job_elapsed(const struct timespec *start,
+						  const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) +
+		   (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief	This routine converts a timeval to seconds.
+ *
+ * @return	Seconds
+ */
+static double job_seconds(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/**
+ * @brief	This routine prints one line of a time report.
+ */
+static void job_print_times_line(double real, const struct rusage *usage,
+								 const char *cmd, int cmd_len)
+{
+	fprintf(stderr, "%8.3fs %8.3fs %8.3fs %8ldk %7ld %7ld  %.*s\n", real,
+			job_seconds(&usage->ru_utime), job_seconds(&usage->ru_stime),
+			usage->ru_maxrss, usage->ru_nvcsw, usage->ru_nivcsw, cmd_len,
+			cmd);
+}
+
+/**
+ * @brief	This routine reports what every stage of a finished timed
+ * 			job cost, followed by the whole job.
+ */
+void job_print_times(job_t *job)
+{
+	struct rusage total;
+	struct timespec end = job->start;
+	process_t *proc;
+
+	memset(&total, 0, sizeof(total));
+
+	// the job's own output comes first
+	fflush(stdout);
+	fprintf(stderr, "%9s %9s %9s %9s %7s %7s  %s\n", "real", "user", "sys",
+			"maxrss", "vcsw", "ivcsw", "command");
+
+	for (proc = job->root; proc != NULL; proc = proc->next) {
+		const struct rusage *usage = &proc->usage;
+		double real = 0;
+		if (proc->end.tv_sec != 0 || proc->end.tv_nsec != 0) {
+			real = job_elapsed(&proc->start, &proc->end);
+			if (job_elapsed(&end, &proc->end) > 0) {
+				end = proc->end;
+			}
+		}
+
+		job_print_times_line(real, usage, proc->cmd, proc->cmd_len);
+
+		timeradd(&total.ru_utime, &usage->ru_utime, &total.ru_utime);
+		timeradd(&total.ru_stime, &usage->ru_stime, &total.ru_stime);
+		if (usage->ru_maxrss > total.ru_maxrss) {
+			total.ru_maxrss = usage->ru_maxrss;
+		}
+		total.ru_nvcsw += usage->ru_nvcsw;
+		total.ru_nivcsw += usage->ru_nivcsw;
+	}
+
+	job_print_times_line(job_elapsed(&job->start, &end), &total, "total", 5);
+}
+
+/**
+ * @brief	This routine records how a reaped process ended and
+ * 			what it used, and stops watching it.
+ */
+static void job_set_proc_exit(pid_t pid, int status,
+							  const struct rusage *usage)
+{
+	job_pid_entry_t *entry = job_pid_lookup(pid);
+	if (entry == NULL) {
+		return;
+	}
+
+	process_t *proc = entry->proc;
+	if (WIFSIGNALED(status)) {
+		proc->status = STATUS_TERMINATED;
+		proc->exit_code = 128 + WTERMSIG(status);
+	} else {
+		proc->status = STATUS_DONE;
+		proc->exit_code = WEXITSTATUS(status);
+	}
+
+	proc->usage = *usage;
+	clock_gettime(CLOCK_MONOTONIC, &proc->end);
+
+	if (entry->pidfd >= 0) {
+		close(entry->pidfd);
+		entry->pidfd = -1;
+	}
+}
+
 /**
  * @brief	This routine adds a new job
  * 
@@ -99,7 +411,10 @@ int job_insert(job_t *job)
 	}
 
 	job->id = id;
+	job->waited = 0;
 	shell->jobs[id] = job;
+	shell->job_max = id;
+	g_job_count++;
 
 	return id;
 }
@@ -111,29 +426,188 @@ int job_insert(job_t *job)
  */
 int job_remove(int id)
 {
-	if (id > MAX_JOBS || shell->jobs[id] == NULL) {
+	job_t *job = job_get(id);
+	if (job == NULL) {
 		return -1;
 	}
 
-	job_t *job = shell->jobs[id];
 	process_t *proc;
-	process_t *tmp;
-	for (proc = job->root; proc != NULL;) {
-		tmp = proc->next;
-		free(proc->cmd);
-		free(proc->argv);
-		free(proc->in_path);
-		free(proc->out_path);
-		free(proc);
-		proc = tmp;
-	}
-	free(job->cmd);
-	free(job);
+	for (proc = job->root; proc != NULL; proc = proc->next) {
+		job_pid_drop(proc->pid);
+	}
+	job_free(job);
 	shell->jobs[id] = NULL;
+	g_job_count--;
+
+	while (shell->job_max > 0 && shell->jobs[shell->job_max] == NULL) {
+		shell->job_max--;
+	}
 
 	return 0;
 }
 
+/**
+ * @brief	This routine drops a reference to a job. The last one
+ * 			frees the job along with everything that was parsed into it.
+ */
+void job_free(job_t *job)
+{
+	if (--job->refs > 0) {
+		return;
+	}
+
+	job_t *template = job->template;
+	process_t *proc;
+
+	for (proc = job->root; proc != NULL; proc = proc->next) {
+		for (int i = 0; i < proc->nfds; i++) {
+			close(proc->fds[i]);
+		}
+
+		// copies share the lists of their template, which frees them
+		if (template == NULL && proc->body != NULL) {
+			cflow_free(proc->body);
+		}
+	}
+
+	// the job itself lives in its arena
+	arena_t arena = job->arena;
+	arena_release(&arena);
+
+	if (template != NULL) {
+		job_free(template);
+	}
+}
+
+/**
+ * @brief	This routine creates a runnable copy of a parsed job.
+ * 			Tokens, and argv of stages that need no expansion, are
+ * 			shared with the template, which is kept alive meanwhile.
+ * 
+ * @return	New job
+ */
+job_t *job_clone(job_t *template)
+{
+	arena_t arena;
+	arena_init(&arena);
+
+	job_t *job = arena_alloc(&arena, sizeof(job_t));
+	*job = *template;
+	job->arena = arena;
+	job->id = -1;
+	job->pgid = -1;
+	job->refs = 1;
+	job->template = template;
+	template->refs++;
+
+	process_t **link = &job->root;
+	process_t *src;
+	for (src = template->root; src != NULL; src = src->next) {
+		process_t *proc = arena_alloc(&job->arena, sizeof(process_t));
+		*proc = *src;
+		proc->fds = NULL;
+		proc->nfds = 0;
+		proc->pid = -1;
+		proc->status = STATUS_RUNNING;
+		*link = proc;
+		link = &proc->next;
+	}
+
+	return job;
+}
+
+/**
+ * @brief	This routine reads the pipe capacity requested through
+ * 			the PSH_PIPE_SIZE variable.
+ *
+ * @return	Capacity in bytes, or 0 to keep the kernel's default.
+ */
+static int job_pipe_size(void)
+{
+	const char *value = var_get("PSH_PIPE_SIZE");
+	if (value == NULL) {
+		return 0;
+	}
+
+	char *end;
+	long size = strtol(value, &end, 10);
+	if (*end == 'k' || *end == 'K') {
+		size *= 1024;
+		end++;
+	} else if (*end == 'm' || *end == 'M') {
+		size *= 1024 * 1024;
+		end++;
+	}
+
+	if (end == value || *end != '\0' || size <= 0 || size > INT_MAX) {
+		return 0;
+	}
+
+	return (int)size;
+}
+
+/**
+ * @brief	This routine stores a here-document in a sealed memory file
+ * 			rewound for the command to read. Unlike a pipe, it takes a
+ * 			body of any size without anyone reading the other end.
+ *
+ * @return	File descriptor, or -1 on failure.
+ */
+static int job_here_document(const char *text)
+{
+	int fd = memfd_create("psh-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		return -1;
+	}
+
+	size_t len = strlen(text);
+	while (len > 0) {
+		ssize_t written = write(fd, text, len);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			close(fd);
+			return -1;
+		}
+		text += written;
+		len -= written;
+	}
+
+	fcntl(fd, F_ADD_SEALS,
+		  F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+	lseek(fd, 0, SEEK_SET);
+
+	return fd;
+}
+
+/**
+ * @brief	This routine checks if a built-in stage would block reading
+ * 			a terminal or pipe. The shell ignores SIGINT, so such a
+ * 			stage has to be a process of its own to be interrupted.
+ *
+ * @return	1 if it would. Otherwise, 0.
+ */
+static int job_blocks_on_stdin(job_t *job, process_t *proc)
+{
+	struct stat st;
+
+	if (proc->type != COMMAND_BUILTIN || !builtin_reads_stdin(proc)) {
+		return 0;
+	}
+
+	// a later stage reads a pipe, a redirected first one a file
+	if (proc != job->root) {
+		return 1;
+	}
+	if (proc->in_path != NULL) {
+		return 0;
+	}
+
+	return isatty(0) || (fstat(0, &st) == 0 &&
+						 (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)));
+}
+
 /**
  * @brief	This routine launches the command job
  * 
@@ -148,45 +622,170 @@ int job_run(job_t *job)
 	int job_id = -1;
 
 	job_check_zombie();
-	if (job->root->type == COMMAND_EXTERNAL) {
+
+	if (job->timed) {
+		clock_gettime(CLOCK_MONOTONIC, &job->start);
+	}
+
+	// like a syntax error, a substitution that can't run gives up the job
+	int failed = 0;
+	for (proc = job->root; proc != NULL; proc = proc->next) {
+		if (proc->argv == NULL && cflow_expand(&job->arena, proc) < 0) {
+			failed = 1;
+		}
+	}
+	if (failed) {
+		job_free(job);
+		var_set_status(2);
+		return 2;
+	}
+
+	// only jobs that launch processes need an ID to be waited on;
+	// builtins are forked unless they end a foreground job
+	int external = 0;
+	int fork_last = 0;
+	for (proc = job->root; proc != NULL; proc = proc->next) {
+		if (proc->type == COMMAND_EXTERNAL || proc->next != NULL ||
+			job->mode != FG_EXEC) {
+			external = 1;
+		} else if (job_blocks_on_stdin(job, proc)) {
+			external = 1;
+			fork_last = 1;
+		}
+	}
+	if (external) {
 		job_id = job_insert(job);
 	}
 
+	int pipe_size = job_pipe_size();
+
 	for (proc = job->root; proc != NULL; proc = proc->next) {
+		int out_fd = 1;
+		int next_in_fd = 0;
+		int mode = job->mode;
+		if (proc->next == NULL && fork_last) {
+			mode = PIPE_EXEC;
+		}
+
 		if (proc == job->root && proc->in_path != NULL) {
-			in_fd = open(proc->in_path, O_RDONLY);
+			if (proc->in_here != 0) {
+				in_fd = job_here_document(proc->in_path);
+			} else {
+				in_fd = open(proc->in_path, O_RDONLY | O_CLOEXEC);
+			}
 			if (in_fd < 0) {
-				perror(proc->in_path);
-				job_remove(job_id);
-				return -1;
+				perror(proc->in_here != 0 ? "psh" : proc->in_path);
+				if (job_id > 0) {
+					job_remove(job_id);
+				} else {
+					job_free(job);
+				}
+				var_set_status(1);
+				return 1;
 			}
 		}
+
 		if (proc->next != NULL) {
-			pipe(fd);
-			status = command_execute(job, proc, in_fd, fd[1], PIPE_EXEC);
-			close(fd[1]);
-			in_fd = fd[0];
-		} else {
-			int out_fd = 1;
-			if (proc->out_path != NULL) {
-				out_fd = open(proc->out_path, O_CREAT | O_WRONLY,
-							  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-				if (out_fd < 0) {
-					out_fd = 1;
+			// close-on-exec, each stage only gets its ends as stdin/stdout
+			if (pipe2(fd, O_CLOEXEC) < 0) {
+				perror("psh");
+				if (in_fd != 0) {
+					close(in_fd);
 				}
+				break;
+			}
+			if (pipe_size > 0) {
+				// best effort, the kernel caps it at fs.pipe-max-size
+				fcntl(fd[1], F_SETPIPE_SZ, pipe_size);
+			}
+			out_fd = fd[1];
+			next_in_fd = fd[0];
+			mode = PIPE_EXEC;
+		} else if (proc->out_path != NULL) {
+			int flags = O_CREAT | O_WRONLY | O_CLOEXEC;
+			flags |= proc->out_append ? O_APPEND : O_TRUNC;
+			out_fd = open(proc->out_path, flags,
+						  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+			if (out_fd < 0) {
+				perror(proc->out_path);
+				if (in_fd != 0) {
+					close(in_fd);
+				}
+				proc->status = STATUS_DONE;
+				proc->exit_code = 1;
+				status = 1;
+				break;
 			}
-			status = command_execute(job, proc, in_fd, out_fd, job->mode);
 		}
+
+		status = command_execute(job, proc, in_fd, out_fd, mode);
+
+		// the children have their copies, the shell needs neither end
+		if (in_fd != 0) {
+			close(in_fd);
+		}
+		if (out_fd != 1) {
+			close(out_fd);
+		}
+		in_fd = next_in_fd;
 	}
 
-	if (job->root->type == COMMAND_EXTERNAL) {
-		if (status >= 0 && job->mode == FG_EXEC) {
+	if (external) {
+		process_t *last = job->root;
+		while (last->next != NULL) {
+			last = last->next;
+		}
+
+		// only wait once every stage runs and the shell has let go of
+		// the pipes, so a stage that quits early gets its writer EPIPE
+		if (job->mode == FG_EXEC && !job_is_completed(job_id)) {
+			// a forked list isn't in the foreground, it can't hand it on
+			int terminal = shell->interactive && job->pgid > 0;
+			if (terminal) {
+				tcsetpgrp(0, job->pgid);
+			}
+			job_wait(job_id);
+			if (terminal) {
+				signal(SIGTTOU, SIG_IGN);
+				tcsetpgrp(0, getpid());
+				signal(SIGTTOU, SIG_DFL);
+			}
+		}
+
+		if (job->mode == FG_EXEC && job_is_completed(job_id)) {
+			status = last->exit_code;
+			if (job->timed) {
+				job_print_times(job);
+			}
 			job_remove(job_id);
-		} else if (job->mode == BG_EXEC) {
-			job_print_proc(job_id);
+		} else if (job->mode == FG_EXEC) {
+			status = 128 + SIGTSTP;
+		} else if (job->mode == BG_EXEC || job->mode == ASYNC_EXEC ||
+				   job->mode == SUBST_EXEC) {
+			status = 0;
+			// only a terminal gets job notices, not a script's output
+			if (job->mode == BG_EXEC && shell->interactive) {
+				job_print_proc(job_id);
+			}
+			if (job_is_completed(job_id) && job->mode == ASYNC_EXEC) {
+				// its owner collects it like any other finished job
+				g_job_unreported++;
+			} else if (job_is_completed(job_id)) {
+				// nothing was started, no reaping will ever remove it
+				job_remove(job_id);
+			} else {
+				job_watch(job);
+			}
 		}
+	} else {
+		status = job->root->exit_code;
+		if (job->timed) {
+			job_print_times(job);
+		}
+		job_free(job);
 	}
 
+	var_set_status(status);
 	return status;
 }
 
@@ -197,22 +796,13 @@ int job_run(job_t *job)
  */
 int job_set_proc_status(int pid, int status)
 {
-	int i;
-	process_t *proc;
-
-	for (i = 1; i <= MAX_JOBS; i++) {
-		if (shell->jobs[i] == NULL) {
-			continue;
-		}
-		for (proc = shell->jobs[i]->root; proc != NULL; proc = proc->next) {
-			if (proc->pid == pid) {
-				proc->status = status;
-				return 0;
-			}
-		}
+	job_pid_entry_t *entry = job_pid_lookup(pid);
+	if (entry == NULL) {
+		return -1;
 	}
 
-	return -1;
+	entry->proc->status = status;
+	return 0;
 }
 
 /**
@@ -220,18 +810,12 @@ int job_set_proc_status(int pid, int status)
  */
 int job_pid_to_id(int pid)
 {
-	process_t *proc;
-	for (int i = 1; i <= MAX_JOBS; i++) {
-		if (shell->jobs[i] != NULL) {
-			for (proc = shell->jobs[i]->root; proc != NULL; proc = proc->next) {
-				if (proc->pid == pid) {
-					return i;
-				}
-			}
-		}
+	job_pid_entry_t *entry = job_pid_lookup(pid);
+	if (entry == NULL) {
+		return -1;
 	}
 
-	return -1;
+	return entry->job->id;
 }
 
 /**
@@ -239,36 +823,149 @@ int job_pid_to_id(int pid)
  */
 int job_id_to_pid(int id)
 {
-	if (id > MAX_JOBS) {
+	job_t *job = job_get(id);
+	if (job == NULL) {
 		return -1;
 	}
 
-	return shell->jobs[id]->pgid;
+	return job->pgid;
+}
+
+/**
+ * @brief	This routine records a state change reported by wait4().
+ *
+ * @return	ID of the process' job if that job is now complete.
+ * 			Otherwise, 0.
+ */
+static int job_reap(pid_t pid, int status, const struct rusage *usage)
+{
+	if (WIFEXITED(status) || WIFSIGNALED(status)) {
+		job_set_proc_exit(pid, status, usage);
+	} else if (WIFSTOPPED(status)) {
+		job_set_proc_status(pid, STATUS_SUSPENDED);
+	} else if (WIFCONTINUED(status)) {
+		job_set_proc_status(pid, STATUS_CONTINUED);
+	}
+
+	int job_id = job_pid_to_id(pid);
+	if (job_id > 0 && job_is_completed(job_id)) {
+		return job_id;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief	This routine reports a completed job and forgets it.
+ */
+static int job_report(int id)
+{
+	job_t *job = job_get(id);
+
+	// left for the builtin that started it, or for wait in a script
+	if (job->mode == ASYNC_EXEC ||
+		(job->mode == BG_EXEC && !shell->interactive)) {
+		g_job_unreported++;
+		return 0;
+	}
+
+	if (job->mode == SUBST_EXEC) {
+		job_remove(id);
+		return 0;
+	}
+
+	if (shell->interactive) {
+		job_print_status(id);
+	}
+	if (job->timed) {
+		job_print_times(job);
+	}
+	job_remove(id);
+	return 1;
 }
 
 /**
  * @brief	This routine handles job status
+ * 
+ * @return	Number of finished jobs that were reported.
  */
-void job_check_zombie(void)
+int job_check_zombie(void)
 {
 	int status;
 	int pid;
+	int reported = 0;
+	struct rusage usage;
 
-	while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
-		if (WIFEXITED(status)) {
-			job_set_proc_status(pid, STATUS_DONE);
-		} else if (WIFSTOPPED(status)) {
-			job_set_proc_status(pid, STATUS_SUSPENDED);
-		} else if (WIFCONTINUED(status)) {
-			job_set_proc_status(pid, STATUS_CONTINUED);
+	while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED,
+						&usage)) > 0) {
+		int job_id = job_reap(pid, status, &usage);
+		if (job_id > 0) {
+			reported += job_report(job_id);
 		}
+	}
 
-		int job_id = job_pid_to_id(pid);
-		if (job_id > 0 && job_is_completed(job_id)) {
-			job_print_status(job_id);
-			job_remove(job_id);
+	if (g_job_unreported > 0) {
+		g_job_unreported = 0;
+		for (int id = 1; id <= shell->job_max; id++) {
+			if (job_get(id) != NULL && job_is_completed(id)) {
+				reported += job_report(id);
+			}
 		}
 	}
+
+	return reported;
+}
+
+/**
+ * @brief	This routine wakes up the input loop whenever a child
+ * 			changes state. Reaping is left to job_event_drain().
+ */
+static void job_sigchld_handler(int sig)
+{
+	(void)sig;
+	int saved_errno = errno;
+
+	// a full pipe already has a wakeup pending
+	ssize_t ret = write(g_sigchld_pipe[1], "", 1);
+	(void)ret;
+	errno = saved_errno;
+}
+
+/**
+ * @brief	This routine installs the SIGCHLD handler and its self-pipe.
+ * 
+ * @return	Readable end of the pipe, or -1 on failure.
+ */
+int job_event_init(void)
+{
+	if (pipe2(g_sigchld_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+		perror("psh");
+		return -1;
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = job_sigchld_handler;
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, NULL);
+
+	return g_sigchld_pipe[0];
+}
+
+/**
+ * @brief	This routine empties the self-pipe and reaps every child
+ * 			that has changed state.
+ * 
+ * @return	Number of finished jobs that were reported.
+ */
+int job_event_drain(void)
+{
+	char buffer[64];
+	while (read(g_sigchld_pipe[0], buffer, sizeof(buffer)) > 0)
+		;
+
+	return job_check_zombie();
 }
 
 /**
@@ -278,7 +975,8 @@ void job_check_zombie(void)
  */
 int job_wait(int id)
 {
-	if (id > MAX_JOBS || shell->jobs[id] == NULL) {
+	job_t *job = job_get(id);
+	if (job == NULL) {
 		return -1;
 	}
 
@@ -286,15 +984,14 @@ int job_wait(int id)
 	int wait_pid = -1;
 	int wait_count = 0;
 	int status = 0;
+	struct rusage usage;
 
 	do {
-		wait_pid = waitpid(shell->jobs[id]->pgid, &status, WUNTRACED);
+		wait_pid = wait4(-job->pgid, &status, WUNTRACED, &usage);
 		wait_count++;
 
-		if (WIFEXITED(status)) {
-			job_set_proc_status(wait_pid, STATUS_DONE);
-		} else if (WIFSIGNALED(status)) {
-			job_set_proc_status(wait_pid, STATUS_TERMINATED);
+		if (WIFEXITED(status) || WIFSIGNALED(status)) {
+			job_set_proc_exit(wait_pid, status, &usage);
 		} else if (WSTOPSIG(status)) {
 			status = -1;
 			job_set_proc_status(wait_pid, STATUS_SUSPENDED);
@@ -315,12 +1012,11 @@ int job_wait(int id)
 int job_wait_pid(int pid)
 {
 	int status = 0;
+	struct rusage usage;
 
-	waitpid(pid, &status, WUNTRACED);
-	if (WIFEXITED(status)) {
-		job_set_proc_status(pid, STATUS_DONE);
-	} else if (WIFSIGNALED(status)) {
-		job_set_proc_status(pid, STATUS_TERMINATED);
+	wait4(pid, &status, WUNTRACED, &usage);
+	if (WIFEXITED(status) || WIFSIGNALED(status)) {
+		job_set_proc_exit(pid, status, &usage);
 	} else if (WSTOPSIG(status)) {
 		status = -1;
 		job_set_proc_status(pid, STATUS_SUSPENDED);
@@ -329,6 +1025,174 @@ int job_wait_pid(int pid)
 	return status;
 }
 
+/**
+ * @brief	This routine adds the running processes of a job to the
+ * 			epoll instance that job_wait_jobs() sleeps on.
+ */
+void job_watch(job_t *job)
+{
+	if (!g_pidfd_support) {
+		return;
+	}
+
+	if (g_epoll_fd < 0) {
+		g_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (g_epoll_fd < 0) {
+			g_pidfd_support = 0;
+			return;
+		}
+	}
+
+	process_t *proc;
+	for (proc = job->root; proc != NULL; proc = proc->next) {
+		job_pid_entry_t *entry = job_pid_lookup(proc->pid);
+		if (entry == NULL || entry->pidfd >= 0 ||
+			proc->status == STATUS_DONE || proc->status == STATUS_TERMINATED) {
+			continue;
+		}
+
+		// pidfds are close-on-exec, children never see them
+		int pidfd = pidfd_open(proc->pid, 0);
+		struct epoll_event event = { .events = EPOLLIN,
+									 .data.u64 = (uint64_t)proc->pid };
+		if (pidfd < 0 || epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, pidfd, &event)) {
+			// one unwatched process would make epoll miss it, use wait4()
+			if (pidfd >= 0) {
+				close(pidfd);
+			}
+			g_pidfd_support = 0;
+			return;
+		}
+		entry->pidfd = pidfd;
+	}
+}
+
+/**
+ * @brief	This routine sleeps until at least one watched process
+ * 			has exited and reaps what it can, calling done for every
+ * 			job that completed.
+ */
+static void job_wait_event(void (*done)(int id, void *data), void *data)
+{
+	struct epoll_event events[64];
+	struct rusage usage;
+	int status;
+
+	if (!g_pidfd_support) {
+		pid_t pid = wait4(-1, &status, WUNTRACED, &usage);
+		if (pid > 0) {
+			int job_id = job_reap(pid, status, &usage);
+			if (job_id > 0) {
+				done(job_id, data);
+			}
+		}
+		return;
+	}
+
+	int count = epoll_wait(g_epoll_fd, events, 64, -1);
+	for (int i = 0; i < count; i++) {
+		pid_t pid = (pid_t)events[i].data.u64;
+		if (wait4(pid, &status, WNOHANG, &usage) == pid) {
+			int job_id = job_reap(pid, status, &usage);
+			if (job_id > 0) {
+				done(job_id, data);
+			}
+		}
+	}
+}
+
+typedef struct {
+	int all;
+	int pending;
+	int target;
+	int status;
+	int id;
+} job_wait_state_t;
+
+/**
+ * @brief	This routine handles a job that completed while waiting.
+ * 			Jobs waited for are forgotten silently, others (and those
+ * 			past what was asked for) are kept so a later wait can still
+ * 			collect their exit code.
+ */
+static void job_wait_done(int id, void *data)
+{
+	job_wait_state_t *state = data;
+	job_t *job = job_get(id);
+
+	if ((!state->all && !job->waited) || state->pending <= state->target) {
+		g_job_unreported++;
+		return;
+	}
+
+	process_t *last = job->root;
+	while (last->next != NULL) {
+		last = last->next;
+	}
+
+	state->status = last->exit_code;
+	state->id = id;
+	state->pending--;
+	if (job->timed) {
+		job_print_times(job);
+	}
+	job_remove(id);
+}
+
+/**
+ * @brief	This routine waits for the jobs in ids, or for every job if
+ * 			count is 0. With any set, it returns once one of them is done.
+ * 			A job that can't be found must be left out of ids. If id
+ * 			isn't NULL, it receives the ID of the last job collected.
+ *
+ * @return	Exit code of the last job that completed, 127 if there was
+ * 			nothing to wait for.
+ */
+int job_wait_jobs(const int *ids, int count, int any, int *id)
+{
+	job_wait_state_t state = { count == 0, 0, 0, 127, -1 };
+
+	if (state.all) {
+		state.pending = g_job_count;
+	}
+
+	for (int i = 0; i < count; i++) {
+		job_t *job = job_get(ids[i]);
+		if (job != NULL && !job->waited) {
+			job->waited = 1;
+			state.pending++;
+		}
+	}
+
+	state.target = any && state.pending > 0 ? state.pending - 1 : 0;
+
+	// jobs that already finished count first
+	if (g_job_unreported > 0) {
+		g_job_unreported = 0;
+		for (int i = 1; i <= shell->job_max; i++) {
+			if (job_get(i) != NULL && job_is_completed(i)) {
+				job_wait_done(i, &state);
+			}
+		}
+	}
+
+	while (state.pending > state.target) {
+		job_wait_event(job_wait_done, &state);
+	}
+
+	for (int i = 0; i < count; i++) {
+		job_t *job = job_get(ids[i]);
+		if (job != NULL) {
+			job->waited = 0;
+		}
+	}
+
+	if (id != NULL) {
+		*id = state.id;
+	}
+	return state.status;
+}
+
 /**
  * @brief	This routine gets the count of current processes
  *
@@ -336,16 +1200,19 @@ int job_wait_pid(int pid)
  */
 int job_get_proc_count(int id, int filter)
 {
-	if (id > MAX_JOBS || shell->jobs[id] == NULL) {
+	job_t *job = job_get(id);
+	if (job == NULL) {
 		return -1;
 	}
 
 	int count = 0;
 	process_t *proc;
-	for (proc = shell->jobs[id]->root; proc != NULL; proc = proc->next) {
+	for (proc = job->root; proc != NULL; proc = proc->next) {
+		int finished = proc->status == STATUS_DONE ||
+					   proc->status == STATUS_TERMINATED;
 		if (filter == PROC_FILTER_ALL ||
-			(filter == PROC_FILTER_DONE && proc->status == STATUS_DONE) ||
-			(filter == PROC_FILTER_REMAINING && proc->status != STATUS_DONE)) {
+			(filter == PROC_FILTER_DONE && finished) ||
+			(filter == PROC_FILTER_REMAINING && !finished)) {
 			count++;
 		}
 	}
@@ -360,16 +1227,60 @@ int job_get_proc_count(int id, int filter)
  */
 int job_is_completed(int id)
 {
-	if (id > MAX_JOBS || shell->jobs[id] == NULL) {
+	job_t *job = job_get(id);
+	if (job == NULL) {
 		return 0;
 	}
 
 	process_t *proc;
-	for (proc = shell->jobs[id]->root; proc != NULL; proc = proc->next) {
-		if (proc->status != STATUS_DONE) {
+	for (proc = job->root; proc != NULL; proc = proc->next) {
+		if (proc->status != STATUS_DONE && proc->status != STATUS_TERMINATED) {
 			return 0;
 		}
 	}
 
 	return 1;
 }
+
+/**
+ * @brief	This routine removes every job and frees the job table.
+ */
+void job_destroy_all(void)
+{
+	for (int id = shell->job_max; id > 0; id--) {
+		job_remove(id);
+	}
+
+	free(shell->jobs);
+	shell->jobs = NULL;
+	shell->job_capacity = 0;
+
+	free(g_pid_index);
+	g_pid_index = NULL;
+	g_pid_index_size = 0;
+	g_pid_index_count = 0;
+}
+
+/**
+ * @brief	This routine empties the job table of a forked copy of the
+ * 			shell. The jobs belong to the parent, so nothing is freed:
+ * 			the copy may still be running one of them.
+ */
+void job_forget_all(void)
+{
+	for (int id = 1; id <= shell->job_max; id++) {
+		shell->jobs[id] = NULL;
+	}
+	shell->job_max = 0;
+	g_job_count = 0;
+	g_job_unreported = 0;
+
+	if (g_pid_index != NULL) {
+		memset(g_pid_index, 0, g_pid_index_size * sizeof(job_pid_entry_t));
+	}
+	g_pid_index_count = 0;
+
+	// the pidfds and the epoll instance were closed with everything else
+	g_epoll_fd = -1;
+	g_pidfd_support = 1;
+}
@@ -9,13 +9,31 @@
 #ifndef __JOBS_H_
 #define __JOBS_H_
 
+#include <time.h>
 #include <sys/types.h>
+#include <sys/resource.h>
 
-#define MAX_JOBS 64
+#include "arena.h"
+#include "lexer.h"
+
+/**
+ * @brief	Initial number of job table slots, doubled as needed
+ */
+#define JOB_TABLE_SIZE 16
 
 #define BG_EXEC 0
 #define FG_EXEC 1
 #define PIPE_EXEC 2
+/**
+ * @brief	Background job started by a builtin, which collects it
+ * 			itself; it is never announced or reported.
+ */
+#define ASYNC_EXEC 3
+/**
+ * @brief	Producer of a process substitution. It is never announced,
+ * 			and forgotten as soon as it is done.
+ */
+#define SUBST_EXEC 4
 
 #define STATUS_RUNNING 0
 #define STATUS_DONE 1
@@ -27,39 +45,77 @@
 #define PROC_FILTER_DONE 1
 #define PROC_FILTER_REMAINING 2
 
+struct cflow_node;
+
 typedef struct process {
 	char *cmd;
+	int cmd_len;
+	const char *line;
+	token_t *words;
+	int nwords;
+	token_t *in_word;
+	token_t *out_word;
+	int out_append;
+	// TOKEN_DLESS, TOKEN_DLESSDASH or TOKEN_TLESS if stdin is
+	// a here-document or here-string, in_path then holds its text
+	int in_here;
 	int argc;
 	char **argv;
 	char *in_path;
 	char *out_path;
+	// ends of the pipes of its process substitutions, which only
+	// it inherits; they are closed with the job
+	int *fds;
+	int nfds;
 	pid_t pid;
 	int type;
 	int status;
+	int exit_code;
+	struct timespec start;
+	struct timespec end;
+	struct rusage usage;
+	struct cflow_node *body;
 	struct process *next;
 } process_t;
 
-typedef struct {
+typedef struct job {
 	int id;
 	process_t *root;
 	char *cmd;
 	pid_t pgid;
 	int mode;
+	int timed;
+	int waited;
+	struct timespec start;
+	int refs;
+	struct job *template;
+	arena_t arena;
 } job_t;
 
+job_t *job_get(int id);
 int job_get_next_id(void);
 int job_print_proc(int id);
 int job_print_status(int id);
+void job_print_times(job_t *job);
 int job_insert(job_t *job);
 int job_remove(int id);
+void job_free(job_t *job);
+job_t *job_clone(job_t *template);
 int job_run(job_t *job);
+int job_add_pid(job_t *job, process_t *proc);
 int job_set_proc_status(int pid, int status);
 int job_pid_to_id(int pid);
 int job_id_to_pid(int id);
-void job_check_zombie(void);
+int job_check_zombie(void);
+int job_event_init(void);
+int job_event_drain(void);
 int job_wait(int id);
+int job_wait_jobs(const int *ids, int count, int any, int *id);
+void job_watch(job_t *job);
 int job_wait_pid(int pid);
 int job_get_proc_count(int id, int filter);
 int job_is_completed(int id);
+void job_destroy_all(void);
+void job_forget_all(void);
 
 #endif // __JOBS_H_
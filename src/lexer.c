@@ -0,0 +1,728 @@
+/**
+ * @file:		src/lexer.c
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains the routines for
+ * 				splitting a command line into tokens.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "lexer.h"
+#include "cflow.h"
+#include "command.h"
+#include "variable.h"
+
+/**
+ * @brief	Delimiter of the here-document the last lexer_scan() ran
+ * 			out of lines in, and whether it was opened with '<<-'
+ */
+static char *g_open_delimiter = NULL;
+static int g_open_strip = 0;
+
+/**
+ * @brief	This routine checks if a character ends an unquoted word.
+ */
+static int lexer_is_delimiter(char c)
+{
+	return c == '\0' || c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
+		   c == '|' || c == '&' || c == '<' || c == '>' || c == ';' ||
+		   c == '(' || c == ')';
+}
+
+/**
+ * @brief	This routine checks if the '$' at line[pos] starts
+ * 			a parameter expansion.
+ */
+static int lexer_is_param(const char *line, size_t pos)
+{
+	char c = line[pos + 1];
+
+	return isalnum((unsigned char)c) || c == '_' || c == '{' || c == '?';
+}
+
+static long lexer_skip_subst(const char *line, size_t pos);
+
+/**
+ * @brief	This routine finds the backquote closing the command
+ * 			substitution opened at line[pos].
+ *
+ * @return	Position of the closing backquote, or LEXER_INCOMPLETE.
+ */
+static long lexer_skip_backquote(const char *line, size_t pos)
+{
+	for (pos++; line[pos] != '`'; pos++) {
+		if (line[pos] == '\0') {
+			return LEXER_INCOMPLETE;
+		}
+		if (line[pos] == '\\' && line[pos + 1] != '\0') {
+			pos++;
+		}
+	}
+
+	return pos;
+}
+
+/**
+ * @brief	This routine finds the quote closing the double-quoted
+ * 			string opened at line[pos], flagging the expansions in it.
+ *
+ * @return	Position of the closing quote, or LEXER_INCOMPLETE.
+ */
+static long lexer_skip_dquote(const char *line, size_t pos, int *flags)
+{
+	for (pos++; line[pos] != '"'; pos++) {
+		long end = pos;
+
+		if (line[pos] == '\0') {
+			return LEXER_INCOMPLETE;
+		} else if (line[pos] == '\\' && line[pos + 1] != '\0') {
+			end = pos + 1;
+		} else if (line[pos] == '$' && line[pos + 1] == '(') {
+			*flags |= TOKEN_SUBST;
+			end = lexer_skip_subst(line, pos + 1);
+		} else if (line[pos] == '`') {
+			*flags |= TOKEN_SUBST;
+			end = lexer_skip_backquote(line, pos);
+		} else if (line[pos] == '$' && lexer_is_param(line, pos)) {
+			*flags |= TOKEN_VAR;
+		}
+
+		if (end < 0) {
+			return LEXER_INCOMPLETE;
+		}
+		pos = end;
+	}
+
+	return pos;
+}
+
+/**
+ * @brief	This routine finds the parenthesis closing the command
+ * 			substitution whose '(' is at line[pos]. Quotes and nested
+ * 			substitutions in it are skipped as a whole.
+ *
+ * @return	Position of the closing parenthesis, or LEXER_INCOMPLETE.
+ */
+static long lexer_skip_subst(const char *line, size_t pos)
+{
+	int depth = 0;
+	int flags = 0;
+
+	for (;; pos++) {
+		long end = pos;
+		const char *quote;
+
+		switch (line[pos]) {
+		case '\0':
+			return LEXER_INCOMPLETE;
+		case '\\':
+			if (line[pos + 1] != '\0') {
+				end = pos + 1;
+			}
+			break;
+		case '\'':
+			quote = strchr(line + pos + 1, '\'');
+			end = quote != NULL ? quote - line : LEXER_INCOMPLETE;
+			break;
+		case '"':
+			end = lexer_skip_dquote(line, pos, &flags);
+			break;
+		case '`':
+			end = lexer_skip_backquote(line, pos);
+			break;
+		case '(':
+			depth++;
+			break;
+		case ')':
+			if (--depth == 0) {
+				return pos;
+			}
+			break;
+		}
+
+		if (end < 0) {
+			return LEXER_INCOMPLETE;
+		}
+		pos = end;
+	}
+}
+
+/**
+ * @brief	This routine scans a word starting at line[pos], honouring
+ * 			single quotes, double quotes, backslash escapes and
+ * 			command substitutions.
+ * 
+ * @return	Position after the word, or LEXER_INCOMPLETE if a quote
+ * 			or substitution is left open.
+ */
+static long lexer_scan_word(const char *line, size_t pos, int *flags)
+{
+	while (!lexer_is_delimiter(line[pos])) {
+		char c = line[pos];
+
+		if (c == '\\') {
+			*flags |= TOKEN_QUOTED;
+			if (line[pos + 1] != '\0') {
+				pos++;
+			}
+		} else if (c == '\'') {
+			*flags |= TOKEN_QUOTED;
+			const char *end = strchr(line + pos + 1, '\'');
+			if (end == NULL) {
+				return LEXER_INCOMPLETE;
+			}
+			pos = end - line;
+		} else if (c == '"') {
+			*flags |= TOKEN_QUOTED;
+			long end = lexer_skip_dquote(line, pos, flags);
+			if (end < 0) {
+				return LEXER_INCOMPLETE;
+			}
+			pos = end;
+		} else if ((c == '$' && line[pos + 1] == '(') || c == '`') {
+			// nothing inside makes the word a pattern or splits it
+			*flags |= TOKEN_SUBST;
+			long end = c == '`' ? lexer_skip_backquote(line, pos)
+								: lexer_skip_subst(line, pos + 1);
+			if (end < 0) {
+				return LEXER_INCOMPLETE;
+			}
+			pos = end;
+		} else if (c == '$' && lexer_is_param(line, pos)) {
+			*flags |= TOKEN_VAR;
+		} else if (c == '*' || c == '?') {
+			*flags |= TOKEN_GLOB;
+		} else if (c == '[') {
+			// only a bracket that is closed makes a pattern, so
+			// "[" and "]" as test arguments skip the glob
+			for (size_t end = pos + 1; !lexer_is_delimiter(line[end]); end++) {
+				if (line[end] == ']') {
+					*flags |= TOKEN_GLOB;
+					break;
+				}
+			}
+		}
+
+		pos++;
+	}
+
+	return pos;
+}
+
+/**
+ * @brief	This routine reads the bodies of the here-documents opened
+ * 			by tokens *from to count, which start on the line at pos.
+ * 			The delimiter of each is turned into its body.
+ *
+ * @return	Position after the last body, or LEXER_INCOMPLETE if one
+ * 			isn't closed yet.
+ */
+static long lexer_here_bodies(arena_t *arena, const char *line,
+							  token_t *tokens, int count, int *from,
+							  size_t pos)
+{
+	for (int t = *from; t + 1 < count; t++) {
+		if ((tokens[t].type != TOKEN_DLESS &&
+			 tokens[t].type != TOKEN_DLESSDASH) ||
+			tokens[t + 1].type != TOKEN_WORD) {
+			continue;
+		}
+
+		token_t *word = &tokens[t + 1];
+		int strip = tokens[t].type == TOKEN_DLESSDASH;
+
+		// the delimiter only has its quotes removed
+		token_t delimiter = *word;
+		delimiter.flags &= TOKEN_QUOTED;
+		char *end = lexer_word(arena, line, &delimiter, 0);
+		size_t end_len = strlen(end);
+
+		size_t start = pos;
+		int dynamic = 0;
+		for (;;) {
+			if (line[pos] == '\0') {
+				free(g_open_delimiter);
+				g_open_delimiter = strdup(end);
+				g_open_strip = strip;
+				return LEXER_INCOMPLETE;
+			}
+
+			size_t text = pos;
+			while (strip && line[text] == '\t') {
+				text++;
+			}
+
+			size_t next = text + strcspn(line + text, "\n");
+			if (next - text == end_len &&
+				strncmp(line + text, end, end_len) == 0) {
+				pos = next;
+				break;
+			}
+
+			if (memchr(line + pos, '$', next - pos) != NULL ||
+				memchr(line + pos, '`', next - pos) != NULL) {
+				dynamic = 1;
+			}
+			pos = line[next] == '\n' ? next + 1 : next;
+		}
+
+		word->offset = start;
+		word->length = pos - start;
+		if (delimiter.flags & TOKEN_QUOTED) {
+			word->flags = TOKEN_QUOTED;
+		} else {
+			word->flags = dynamic ? TOKEN_VAR | TOKEN_SUBST : 0;
+		}
+
+		if (line[pos] == '\n') {
+			pos++;
+		}
+	}
+
+	*from = count;
+	return pos;
+}
+
+/**
+ * @brief	This routine tells which here-document the last call to
+ * 			lexer_scan() was still reading, so its body can be
+ * 			collected before the line is scanned again.
+ *
+ * @return	Delimiter, or NULL if no here-document was left open.
+ */
+const char *lexer_open_heredoc(int *strip)
+{
+	*strip = g_open_strip;
+	return g_open_delimiter;
+}
+
+/**
+ * @brief	This routine splits a line into tokens in a single pass.
+ * 			Tokens refer to the line by offset and length, so the
+ * 			line has to outlive them.
+ * 
+ * @return	Number of tokens, or LEXER_INCOMPLETE if a quote is left open.
+ */
+int lexer_scan(arena_t *arena, const char *line, token_t **tokens)
+{
+	int capacity = PSH_COMMAND_BUFSIZE;
+	int count = 0;
+	token_t *arr = arena_alloc(arena, capacity * sizeof(token_t));
+	size_t pos = 0;
+	int here_from = 0;
+
+	free(g_open_delimiter);
+	g_open_delimiter = NULL;
+
+	for (;;) {
+		while (line[pos] == ' ' || line[pos] == '\t' || line[pos] == '\r') {
+			pos++;
+		}
+
+		if (line[pos] == '#') {
+			while (line[pos] != '\0' && line[pos] != '\n') {
+				pos++;
+			}
+		}
+
+		if (line[pos] == '\0') {
+			// a here-document opened on the last line has no body yet
+			if (lexer_here_bodies(arena, line, arr, count, &here_from, pos) <
+				0) {
+				return LEXER_INCOMPLETE;
+			}
+			break;
+		}
+
+		if (count == capacity) {
+			arr = arena_realloc(arena, arr, capacity * sizeof(token_t),
+								2 * capacity * sizeof(token_t));
+			capacity *= 2;
+		}
+
+		token_t *token = &arr[count++];
+		token->offset = pos;
+		token->flags = 0;
+
+		// a process substitution is a word of its own
+		if ((line[pos] == '<' || line[pos] == '>') && line[pos + 1] == '(') {
+			long end = lexer_skip_subst(line, pos + 1);
+			if (end < 0) {
+				return LEXER_INCOMPLETE;
+			}
+			token->type = TOKEN_WORD;
+			token->flags = TOKEN_PSUBST;
+			token->length = end + 1 - pos;
+			pos = end + 1;
+			continue;
+		}
+
+		switch (line[pos]) {
+		case '|':
+			token->type = TOKEN_PIPE;
+			pos++;
+			if (line[pos] == '|') {
+				token->type = TOKEN_OR_IF;
+				pos++;
+			}
+			break;
+		case '&':
+			token->type = TOKEN_AMP;
+			pos++;
+			if (line[pos] == '&') {
+				token->type = TOKEN_AND_IF;
+				pos++;
+			}
+			break;
+		case ';':
+			token->type = TOKEN_SEMI;
+			pos++;
+			if (line[pos] == ';') {
+				token->type = TOKEN_DSEMI;
+				pos++;
+			}
+			break;
+		case '\n':
+			// only lines joined by a continuation have these
+			token->type = TOKEN_NEWLINE;
+			pos++;
+			break;
+		case '(':
+			token->type = TOKEN_LPAREN;
+			pos++;
+			break;
+		case ')':
+			token->type = TOKEN_RPAREN;
+			pos++;
+			break;
+		case '<':
+			token->type = TOKEN_LESS;
+			pos++;
+			if (line[pos] == '<') {
+				token->type = TOKEN_DLESS;
+				pos++;
+				if (line[pos] == '<') {
+					token->type = TOKEN_TLESS;
+					pos++;
+				} else if (line[pos] == '-') {
+					token->type = TOKEN_DLESSDASH;
+					pos++;
+				}
+			}
+			break;
+		case '>':
+			token->type = TOKEN_GREAT;
+			pos++;
+			if (line[pos] == '>') {
+				token->type = TOKEN_DGREAT;
+				pos++;
+			}
+			break;
+		default: {
+			long end = lexer_scan_word(line, pos, &token->flags);
+			if (end < 0) {
+				return LEXER_INCOMPLETE;
+			}
+			token->type = TOKEN_WORD;
+			pos = end;
+			break;
+		}
+		}
+
+		token->length = pos - token->offset;
+
+		// bodies of here-documents start on the next line
+		if (token->type == TOKEN_NEWLINE) {
+			long end = lexer_here_bodies(arena, line, arr, count, &here_from,
+										 pos);
+			if (end < 0) {
+				return LEXER_INCOMPLETE;
+			}
+			// and don't separate anything if nothing follows them
+			if (line[end] == '\0' && (size_t)end != pos) {
+				count--;
+			}
+			pos = end;
+		}
+	}
+
+	*tokens = arr;
+	return count;
+}
+
+/**
+ * @brief	This routine looks up the parameter expanded by the '$' at
+ * 			src[*i]: $name, ${name} or $?. *i is left on the last
+ * 			character of the expansion.
+ *
+ * @return	1 if there is one, with its value in *value.
+ * 			Otherwise, 0.
+ */
+static int lexer_param(const char *src, size_t len, size_t *i,
+					   const char **value)
+{
+	size_t start = *i + 1;
+	size_t end = start;
+	size_t last;
+
+	if (start < len && src[start] == '{') {
+		start++;
+		end = start;
+		while (end < len && src[end] != '}') {
+			end++;
+		}
+		if (end == len || end == start) {
+			return 0;
+		}
+		last = end;
+	} else if (start < len && (src[start] == '?' ||
+							   isdigit((unsigned char)src[start]))) {
+		// a special or positional parameter is a single character
+		end = start + 1;
+		last = start;
+	} else {
+		while (end < len &&
+			   (isalnum((unsigned char)src[end]) || src[end] == '_')) {
+			end++;
+		}
+		if (end == start) {
+			return 0;
+		}
+		last = end - 1;
+	}
+
+	char name[end - start + 1];
+	memcpy(name, src + start, end - start);
+	name[end - start] = '\0';
+
+	*value = var_get(name);
+	if (*value == NULL) {
+		*value = "";
+	}
+	*i = last;
+
+	return 1;
+}
+
+/**
+ * @brief	This routine runs the command substitution at src[*i],
+ * 			$(...) or `...`, and leaves *i on its last character.
+ * 			In backquotes, a backslash only escapes '$', '`' and
+ * 			another backslash.
+ *
+ * @return	Output of the command, without trailing newlines
+ */
+static const char *lexer_subst(arena_t *arena, const char *src, size_t *i)
+{
+	size_t start = *i;
+
+	if (src[start] == '$') {
+		size_t end = lexer_skip_subst(src, start + 1);
+		*i = end;
+		return cflow_substitute(arena, src + start + 2, end - start - 2);
+	}
+
+	size_t end = lexer_skip_backquote(src, start);
+	char *body = arena_alloc(arena, end - start);
+	size_t len = 0;
+
+	for (size_t pos = start + 1; pos < end; pos++) {
+		if (src[pos] == '\\' && strchr("$`\\", src[pos + 1]) != NULL) {
+			pos++;
+		}
+		body[len++] = src[pos];
+	}
+
+	*i = end;
+	return cflow_substitute(arena, body, len);
+}
+
+/**
+ * @brief	This routine appends the value of an expansion to a word,
+ * 			growing it so reserve bytes are left for the rest. Quoted
+ * 			values get glob characters escaped with LEXER_GLOB_ESCAPE,
+ * 			unquoted ones are split at blanks with LEXER_SPLIT_FIELDS.
+ *
+ * @return	Word, which may have moved
+ */
+static char *lexer_append(arena_t *arena, char *word, size_t *used,
+						  size_t *capacity, size_t reserve,
+						  const char *value, int quoted, int flags)
+{
+	size_t need = *used + 2 * strlen(value) + reserve;
+	if (need > *capacity) {
+		word = arena_realloc(arena, word, *capacity, 2 * need);
+		*capacity = 2 * need;
+	}
+
+	for (; *value != '\0'; value++) {
+		char c = *value;
+
+		if (quoted && (flags & LEXER_GLOB_ESCAPE) && strchr("*?[]\\", c)) {
+			word[(*used)++] = '\\';
+		} else if (!quoted && (flags & LEXER_SPLIT_FIELDS) &&
+				   (c == ' ' || c == '\t' || c == '\n')) {
+			c = LEXER_FIELD_SEP;
+		}
+		word[(*used)++] = c;
+	}
+
+	return word;
+}
+
+/**
+ * @brief	This routine materializes a word token, expanding
+ * 			parameters and removing quotes and escapes. With
+ * 			LEXER_GLOB_ESCAPE, glob characters that were quoted keep
+ * 			a backslash so they match literally. With
+ * 			LEXER_SPLIT_FIELDS, blanks that unquoted expansions
+ * 			produced become LEXER_FIELD_SEP.
+ * 
+ * @return	NUL-terminated word allocated from the arena
+ */
+char *lexer_word(arena_t *arena, const char *line, const token_t *token,
+				 int flags)
+{
+	const char *src = line + token->offset;
+	size_t len = token->length;
+
+	if (token->flags & TOKEN_PSUBST) {
+		return cflow_process_subst(arena, src + 2, len - 3, src[0] == '>');
+	}
+
+	if (!(token->flags & (TOKEN_QUOTED | TOKEN_VAR | TOKEN_SUBST))) {
+		return arena_strndup(arena, src, len);
+	}
+
+	size_t capacity = 2 * len + 1;
+	size_t used = 0;
+	char *word = arena_alloc(arena, capacity);
+	char quote = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		char c = src[i];
+		int literal = 1;
+		const char *value;
+
+		if (quote != '\'' && (token->flags & TOKEN_SUBST) &&
+			((c == '$' && src[i + 1] == '(') || c == '`')) {
+			value = lexer_subst(arena, src, &i);
+			word = lexer_append(arena, word, &used, &capacity,
+								2 * (len - i) + 1, value, quote != 0, flags);
+			continue;
+		}
+
+		if (c == '$' && quote != '\'' && (token->flags & TOKEN_VAR) &&
+			lexer_param(src, len, &i, &value)) {
+			word = lexer_append(arena, word, &used, &capacity,
+								2 * (len - i) + 1, value, quote != 0, flags);
+			continue;
+		}
+
+		if (quote == '\'') {
+			if (c == '\'') {
+				quote = 0;
+				continue;
+			}
+		} else if (quote == '"') {
+			if (c == '"') {
+				quote = 0;
+				continue;
+			}
+			if (c == '\\' && i + 1 < len && strchr("$`\"\\", src[i + 1])) {
+				c = src[++i];
+			}
+		} else if (c == '\'' || c == '"') {
+			quote = c;
+			continue;
+		} else if (c == '\\' && i + 1 < len) {
+			c = src[++i];
+		} else {
+			literal = 0;
+		}
+
+		if (literal && (flags & LEXER_GLOB_ESCAPE) && strchr("*?[]\\", c)) {
+			word[used++] = '\\';
+		}
+		word[used++] = c;
+	}
+
+	word[used] = '\0';
+	return word;
+}
+
+/**
+ * @brief	This routine materializes the body of a here-document.
+ * 			Unless its delimiter was quoted, parameters and commands
+ * 			are expanded, and a backslash escapes '$', '`', another
+ * 			backslash or a newline. LEXER_STRIP_TABS removes the
+ * 			leading tabs of every line.
+ *
+ * @return	NUL-terminated document allocated from the arena
+ */
+char *lexer_heredoc(arena_t *arena, const char *line, const token_t *token,
+					int flags)
+{
+	const char *src = line + token->offset;
+	size_t len = token->length;
+
+	// the last line is the delimiter
+	while (len > 0 && src[len - 1] != '\n') {
+		len--;
+	}
+
+	if ((token->flags & TOKEN_QUOTED) && !(flags & LEXER_STRIP_TABS)) {
+		return arena_strndup(arena, src, len);
+	}
+
+	size_t capacity = len + 1;
+	size_t used = 0;
+	char *doc = arena_alloc(arena, capacity);
+	int line_start = 1;
+
+	for (size_t i = 0; i < len; i++) {
+		char c = src[i];
+
+		if (line_start && c == '\t' && (flags & LEXER_STRIP_TABS)) {
+			continue;
+		}
+		line_start = c == '\n';
+
+		if (token->flags & TOKEN_QUOTED) {
+			doc[used++] = c;
+			continue;
+		}
+
+		const char *value = NULL;
+		if (c == '\\' && i + 1 < len && strchr("$`\\\n", src[i + 1])) {
+			c = src[++i];
+			if (c == '\n') {
+				continue;
+			}
+		} else if ((c == '$' && src[i + 1] == '(') || c == '`') {
+			// an unclosed one is just text
+			long end = c == '`' ? lexer_skip_backquote(src, i)
+								: lexer_skip_subst(src, i + 1);
+			if (end >= 0 && (size_t)end < len) {
+				value = lexer_subst(arena, src, &i);
+			}
+		} else if (c == '$') {
+			lexer_param(src, len, &i, &value);
+		}
+
+		if (value != NULL) {
+			doc = lexer_append(arena, doc, &used, &capacity, len - i + 1,
+							   value, 1, 0);
+			continue;
+		}
+		doc[used++] = c;
+	}
+
+	doc[used] = '\0';
+	return doc;
+}
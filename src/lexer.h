@@ -0,0 +1,77 @@
+/**
+ * @file:		src/lexer.h
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains the routines for
+ * 				splitting a command line into tokens.
+ */
+
+#ifndef __LEXER_H_
+#define __LEXER_H_
+
+#include <stddef.h>
+
+#include "arena.h"
+
+#define TOKEN_WORD 0
+#define TOKEN_PIPE 1
+#define TOKEN_AMP 2
+#define TOKEN_LESS 3
+#define TOKEN_GREAT 4
+#define TOKEN_DGREAT 5
+#define TOKEN_SEMI 6
+#define TOKEN_AND_IF 7
+#define TOKEN_OR_IF 8
+#define TOKEN_NEWLINE 9
+#define TOKEN_DSEMI 10
+#define TOKEN_LPAREN 11
+#define TOKEN_RPAREN 12
+#define TOKEN_DLESS 13
+#define TOKEN_DLESSDASH 14
+#define TOKEN_TLESS 15
+
+/**
+ * @brief	Token flags
+ */
+#define TOKEN_QUOTED (1 << 0)
+#define TOKEN_GLOB (1 << 1)
+#define TOKEN_VAR (1 << 2)
+#define TOKEN_SUBST (1 << 3)
+#define TOKEN_PSUBST (1 << 4)
+
+#define LEXER_INCOMPLETE -1
+
+/**
+ * @brief	lexer_word() flags
+ */
+#define LEXER_GLOB_ESCAPE (1 << 0)
+#define LEXER_SPLIT_FIELDS (1 << 1)
+#define LEXER_STRIP_TABS (1 << 2)
+
+/**
+ * @brief	Marks where lexer_word() split an unquoted expansion
+ * 			into separate fields
+ */
+#define LEXER_FIELD_SEP '\001'
+
+/**
+ * @brief	A token is a view into the scanned line, nothing is copied.
+ * 			The delimiter after '<<' becomes the body of the
+ * 			here-document once it is read, from the line after the
+ * 			command up to the end of the line closing it.
+ */
+typedef struct {
+	int type;
+	int flags;
+	size_t offset;
+	size_t length;
+} token_t;
+
+int lexer_scan(arena_t *arena, const char *line, token_t **tokens);
+char *lexer_word(arena_t *arena, const char *line, const token_t *token,
+				 int flags);
+char *lexer_heredoc(arena_t *arena, const char *line, const token_t *token,
+					int flags);
+const char *lexer_open_heredoc(int *strip);
+
+#endif // __LEXER_H_
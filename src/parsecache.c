@@ -0,0 +1,95 @@
+/**
+ * @file:		src/parsecache.c
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains the routines for
+ * 				reusing parsed command lines.
+ */
+
+#include <stdio.h>
+
+#include "hashtable.h"
+#include "parsecache.h"
+#include "cflow.h"
+
+static hashtable_t *g_parse_hashtable = NULL;
+static unsigned long g_parse_hits = 0;
+static unsigned long g_parse_misses = 0;
+
+/**
+ * @brief	This routine looks up a previously parsed line.
+ * 
+ * @return	Fresh copy of the cached job, or NULL on a miss.
+ */
+job_t *parsecache_lookup(const char *line)
+{
+	job_t *template = NULL;
+	if (g_parse_hashtable != NULL) {
+		template = hashtable_search(g_parse_hashtable, line);
+	}
+
+	if (template == NULL) {
+		g_parse_misses++;
+		return NULL;
+	}
+
+	g_parse_hits++;
+	return job_clone(template);
+}
+
+/**
+ * @brief	This routine turns a freshly parsed job into a cache template.
+ * 			Stages without globs are expanded once, here; the others
+ * 			are expanded again on every run.
+ * 
+ * @return	Fresh copy of the template to run.
+ */
+job_t *parsecache_insert(const char *line, job_t *template)
+{
+	if (g_parse_hashtable == NULL) {
+		g_parse_hashtable = hashtable_create();
+	} else if (g_parse_hashtable->count >= PARSECACHE_MAX_ENTRIES) {
+		// every template holds an arena, don't let a long script pile them up
+		parsecache_clear();
+		g_parse_hashtable = hashtable_create();
+	}
+
+	cflow_expand_static(template);
+
+	hashtable_insert(g_parse_hashtable, line, template);
+
+	return job_clone(template);
+}
+
+/**
+ * @brief	This routine prints how well the parse cache is doing.
+ */
+void parsecache_print_stats(void)
+{
+	unsigned long total = g_parse_hits + g_parse_misses;
+	size_t entries = g_parse_hashtable ? g_parse_hashtable->count : 0;
+
+	printf("parse cache: %zu entries, %lu hits, %lu misses (%.1f%% hit rate)\n",
+		   entries, g_parse_hits, g_parse_misses,
+		   total ? 100.0 * g_parse_hits / total : 0.0);
+}
+
+/**
+ * @brief	This routine drops every cached parse. Jobs still running
+ * 			from a template keep it alive until they are freed.
+ */
+void parsecache_clear(void)
+{
+	if (g_parse_hashtable == NULL) {
+		return;
+	}
+
+	size_t pos = 0;
+	hashtable_entry_t *entry;
+	while ((entry = hashtable_next(g_parse_hashtable, &pos)) != NULL) {
+		job_free(entry->value);
+	}
+
+	hashtable_destroy(g_parse_hashtable);
+	g_parse_hashtable = NULL;
+}
@@ -0,0 +1,24 @@
+/**
+ * @file:		src/parsecache.h
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains the routines for
+ * 				reusing parsed command lines.
+ */
+
+#ifndef __PARSECACHE_H_
+#define __PARSECACHE_H_
+
+#include "jobs.h"
+
+/**
+ * @brief	Number of cached lines after which the cache starts over
+ */
+#define PARSECACHE_MAX_ENTRIES 1024
+
+job_t *parsecache_lookup(const char *line);
+job_t *parsecache_insert(const char *line, job_t *template);
+void parsecache_print_stats(void);
+void parsecache_clear(void);
+
+#endif // __PARSECACHE_H_
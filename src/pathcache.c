@@ -0,0 +1,178 @@
+/**
+ * @file:		src/pathcache.c
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains the routines for
+ * 				caching resolved paths of external commands.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "hashtable.h"
+#include "pathcache.h"
+#include "variable.h"
+
+static hashtable_t *g_path_hashtable = NULL;
+
+/**
+ * @brief	This routine searches every directory in $PATH for
+ * 			an executable called name.
+ *
+ * @return	Newly allocated absolute path, or NULL if nothing was found.
+ */
+char *pathcache_resolve(const char *name)
+{
+	const char *dirs = var_get("PATH");
+	char candidate[PATH_MAX];
+	struct stat st;
+
+	if (dirs == NULL) {
+		dirs = "/usr/local/bin:/usr/bin:/bin";
+	}
+
+	while (*dirs != '\0') {
+		const char *end = strchr(dirs, ':');
+		size_t dir_len = end ? (size_t)(end - dirs) : strlen(dirs);
+
+		// an empty entry stands for the current directory
+		int len;
+		if (dir_len == 0) {
+			len = snprintf(candidate, sizeof(candidate), "./%s", name);
+		} else {
+			len = snprintf(candidate, sizeof(candidate), "%.*s/%s",
+						   (int)dir_len, dirs, name);
+		}
+
+		if (len > 0 && (size_t)len < sizeof(candidate) &&
+			stat(candidate, &st) == 0 && S_ISREG(st.st_mode) &&
+			access(candidate, X_OK) == 0) {
+			return strdup(candidate);
+		}
+
+		if (end == NULL) {
+			break;
+		}
+		dirs = end + 1;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief	This routine resolves name and stores it in the cache.
+ *
+ * @return	Cache entry, or NULL if name couldn't be resolved.
+ */
+static pathcache_entry_t *pathcache_insert(const char *name)
+{
+	char *path = pathcache_resolve(name);
+	if (path == NULL) {
+		return NULL;
+	}
+
+	if (g_path_hashtable == NULL) {
+		g_path_hashtable = hashtable_create();
+	}
+
+	pathcache_entry_t *entry = hashtable_search(g_path_hashtable, name);
+	if (entry != NULL) {
+		free(entry->path);
+		entry->path = path;
+		return entry;
+	}
+
+	entry = malloc(sizeof(pathcache_entry_t));
+	entry->path = path;
+	entry->hits = 0;
+	hashtable_insert(g_path_hashtable, name, entry);
+
+	return entry;
+}
+
+/**
+ * @brief	This routine returns the full path of a command,
+ * 			consulting $PATH only on a cache miss. Names containing
+ * 			a slash are returned unchanged.
+ *
+ * @return	Path to execute, or NULL if the command wasn't found.
+ */
+const char *pathcache_lookup(const char *name)
+{
+	if (strchr(name, '/') != NULL) {
+		return name;
+	}
+
+	pathcache_entry_t *entry = NULL;
+	if (g_path_hashtable != NULL) {
+		entry = hashtable_search(g_path_hashtable, name);
+	}
+
+	if (entry == NULL) {
+		entry = pathcache_insert(name);
+		if (entry == NULL) {
+			return NULL;
+		}
+	}
+
+	entry->hits++;
+	return entry->path;
+}
+
+/**
+ * @brief	This routine (re)resolves a command and caches it.
+ *
+ * @return	0 if the command was found. Otherwise, -1.
+ */
+int pathcache_add(const char *name)
+{
+	if (strchr(name, '/') != NULL) {
+		return 0;
+	}
+
+	return pathcache_insert(name) != NULL ? 0 : -1;
+}
+
+/**
+ * @brief	This routine prints every cached command.
+ */
+void pathcache_print(void)
+{
+	if (g_path_hashtable == NULL || g_path_hashtable->count == 0) {
+		printf("hash: hash table empty\n");
+		return;
+	}
+
+	printf("hits\tcommand\n");
+	size_t pos = 0;
+	hashtable_entry_t *entry;
+	while ((entry = hashtable_next(g_path_hashtable, &pos)) != NULL) {
+		pathcache_entry_t *cached = entry->value;
+		printf("%4d\t%s\n", cached->hits, cached->path);
+	}
+}
+
+/**
+ * @brief	This routine forgets every cached path.
+ */
+void pathcache_clear(void)
+{
+	if (g_path_hashtable == NULL) {
+		return;
+	}
+
+	size_t pos = 0;
+	hashtable_entry_t *entry;
+	while ((entry = hashtable_next(g_path_hashtable, &pos)) != NULL) {
+		pathcache_entry_t *cached = entry->value;
+		free(cached->path);
+		free(cached);
+	}
+
+	hashtable_destroy(g_path_hashtable);
+	g_path_hashtable = NULL;
+}
@@ -0,0 +1,23 @@
+/**
+ * @file:		src/pathcache.h
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains the routines for
+ * 				caching resolved paths of external commands.
+ */
+
+#ifndef __PATHCACHE_H_
+#define __PATHCACHE_H_
+
+typedef struct {
+	char *path;
+	int hits;
+} pathcache_entry_t;
+
+char *pathcache_resolve(const char *name);
+const char *pathcache_lookup(const char *name);
+int pathcache_add(const char *name);
+void pathcache_print(void);
+void pathcache_clear(void);
+
+#endif // __PATHCACHE_H_
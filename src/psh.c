@@ -11,96 +11,222 @@
 #include <signal.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
 
 #include "psh.h"
+#include "cflow.h"
 #include "command.h"
 #include "jobs.h"
 #include "builtin.h"
-#include "hashtable.h"
-
-static char *g_buffer;
+#include "input.h"
+#include "lexer.h"
+#include "parsecache.h"
+#include "pathcache.h"
+#include "variable.h"
+#include "wildcard.h"
+
+static input_t *g_input;
+static char g_prompt[256];
 psh_info_t *shell;
 
+/**
+ * @brief	This routine reports background jobs as soon as they finish,
+ * 			while the shell waits for input.
+ */
+static void psh_child_event(void)
+{
+	if (job_event_drain() > 0) {
+		printf("%s ", g_prompt);
+		fflush(stdout);
+	}
+}
+
 /**
  * @brief	Main entry point
+ * 
+ * 			psh				read commands from stdin
+ * 			psh -s			same, even if further arguments follow
+ * 			psh file		run a script
  */
 int main(int argc, char **argv)
 {
-	(void)argc;
-	(void)argv;
+	int script_fd = 0;
 
-	atexit(free_everything);
+	if (argc > 1 && strcmp(argv[1], "-s") != 0) {
+		script_fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+		if (script_fd < 0) {
+			perror(argv[1]);
+			exit(127);
+		}
+	}
 
-	signal(SIGINT, SIG_IGN);
-	signal(SIGTSTP, SIG_IGN);
+	atexit(free_everything);
 
 	shell = (psh_info_t *)malloc(sizeof(psh_info_t));
 
-	for (int i = 0; i <= MAX_JOBS; i++) {
-		shell->jobs[i] = NULL;
+	shell->jobs = NULL;
+	shell->job_capacity = 0;
+	shell->job_max = 0;
+	shell->options = OPTION_POSIX_SPAWN;
+	shell->interactive = script_fd == 0 && isatty(0);
+
+	var_init(environ);
+
+	if (shell->interactive) {
+		signal(SIGINT, SIG_IGN);
+		signal(SIGTSTP, SIG_IGN);
 	}
 
-	char prompt[128];
-	char hostname[1024];
-	gethostname(hostname, 1024);
+	char hostname[HOST_NAME_MAX + 1];
+	gethostname(hostname, sizeof(hostname));
 
 	getlogin_r(shell->cur_user, sizeof(shell->cur_user));
 
-	snprintf(prompt, sizeof(prompt), "%s@%s $", shell->cur_user, hostname);
+	snprintf(g_prompt, sizeof(g_prompt), "%s@%s $", shell->cur_user,
+			 hostname);
 
 	job_t *job;
-
-	size_t buffer_size = 512;
-	g_buffer = (char *)malloc(buffer_size * sizeof(char));
-	if (g_buffer == NULL) {
-		perror("malloc");
-		exit(1);
+	char *line;
+	char *pending = NULL;
+	size_t pending_len = 0;
+	size_t pending_size = 0;
+	char *here_end = NULL;
+	int here_strip = 0;
+	cflow_nesting_t nesting;
+
+	g_input = input_open(script_fd);
+	if (shell->interactive) {
+		int event_fd = job_event_init();
+		if (event_fd >= 0) {
+			input_set_event(g_input, event_fd, psh_child_event);
+		}
 	}
 
-	builtin_init();
-
-	FILE *motd = fopen("/etc/motd", "r");
-	if (motd != NULL) {
-		char c = fgetc(motd);
-		while (c != EOF) {
-			printf("%c", c);
-			c = fgetc(motd);
+	if (shell->interactive) {
+		FILE *motd = fopen("/etc/motd", "r");
+		if (motd != NULL) {
+			char c = fgetc(motd);
+			while (c != EOF) {
+				printf("%c", c);
+				c = fgetc(motd);
+			}
+			fclose(motd);
 		}
-		fclose(motd);
 	}
 
 	for (;;) {
-		printf("%s ", prompt);
+		if (shell->interactive) {
+			printf("%s ", pending == NULL ? g_prompt : ">");
+			fflush(stdout);
+		}
 
-		int num_bytes = getline(&g_buffer, &buffer_size, stdin);
+		line = input_next_line(g_input);
 		// EOF
-		if (num_bytes == -1) {
+		if (line == NULL) {
+			// the nesting is only a guess, the parser has the last word
+			if (pending != NULL && here_end == NULL) {
+				job = command_parse(pending);
+				if (job != NULL || !command_is_incomplete()) {
+					free(pending);
+					pending = NULL;
+					if (job != NULL) {
+						job_run(job);
+					}
+					continue;
+				}
+			}
+			if (pending != NULL) {
+				fprintf(stderr, "psh: syntax error: unexpected end of file\n");
+				free(pending);
+				exit(2);
+			}
 			exit(0);
 		}
 
-		if (g_buffer[0] == '\n') {
-			continue;
+		// a command that goes on over several lines is parsed as a whole
+		if (pending != NULL) {
+			size_t len = strlen(line);
+			if (pending_len + len + 2 > pending_size) {
+				pending_size = 2 * (pending_len + len + 2);
+				pending = realloc(pending, pending_size);
+				if (pending == NULL) {
+					perror("psh");
+					exit(1);
+				}
+			}
+			pending[pending_len++] = '\n';
+			memcpy(pending + pending_len, line, len + 1);
+			pending_len += len;
+
+			// nothing is parsed until a here-document is closed
+			if (here_end != NULL) {
+				const char *text = line;
+				while (here_strip && *text == '\t') {
+					text++;
+				}
+				if (strcmp(text, here_end) != 0) {
+					continue;
+				}
+				free(here_end);
+				here_end = NULL;
+			}
+
+			// parsing it all again only pays once nothing is left open
+			if (!cflow_scan_nesting(&nesting, pending)) {
+				const char *delimiter = lexer_open_heredoc(&here_strip);
+				if (delimiter != NULL &&
+					(here_end = strdup(delimiter)) == NULL) {
+					perror("psh");
+					exit(1);
+				}
+				continue;
+			}
+			line = pending;
 		}
 
-		// check for C-D / NULL
-		if (g_buffer == NULL) {
-			exit(0);
+		job = command_parse(line);
+		if (job == NULL && command_is_incomplete()) {
+			if (pending == NULL) {
+				pending_len = strlen(line);
+				pending_size = pending_len + 1;
+				if ((pending = strdup(line)) == NULL) {
+					perror("psh");
+					exit(1);
+				}
+				cflow_nesting_init(&nesting);
+				cflow_scan_nesting(&nesting, pending);
+			}
+
+			const char *delimiter = lexer_open_heredoc(&here_strip);
+			if (delimiter != NULL && (here_end = strdup(delimiter)) == NULL) {
+				perror("psh");
+				exit(1);
+			}
+			continue;
 		}
 
-		job = command_parse(g_buffer);
-		job_run(job);
+		free(pending);
+		pending = NULL;
+
+		if (job != NULL) {
+			job_run(job);
+		}
 	}
 
 	return 0;
 }
 
 /**
- * @brief	This routine free's all allocated memory
- * 			and destroys the hashtable.
+ * @brief	This routine free's all allocated memory.
  */
 void free_everything(void)
 {
-	hashtable_destroy(g_builtin_hashtable);
+	job_destroy_all();
+	parsecache_clear();
+	pathcache_clear();
+	var_clear();
+	wildcard_clear();
 	free(shell);
-	free(g_buffer);
+	input_close(g_input);
 }
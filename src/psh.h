@@ -16,10 +16,19 @@
 #define SHELL_VERSION "0.1"
 #define SHELL_COPYRIGHT "Copyright (c) Jozef Nagy 2023-2024"
 
+/**
+ * @brief	Shell options, toggled with "set -o" / "set +o"
+ */
+#define OPTION_POSIX_SPAWN (1 << 0)
+
 typedef struct {
 	char cur_user[64];
 	char cwd[1024];
-	job_t *jobs[MAX_JOBS];
+	job_t **jobs;
+	int job_capacity;
+	int job_max;
+	int options;
+	int interactive;
 } psh_info_t;
 
 extern psh_info_t *shell;
@@ -0,0 +1,406 @@
+/**
+ * @file:		src/variable.c
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains the routines for
+ * 				shell variables and the environment of commands.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "hashtable.h"
+#include "pathcache.h"
+#include "variable.h"
+
+static hashtable_t *g_vars = NULL;
+
+/**
+ * @brief	Environment handed to every command. It only points at the
+ * 			entries of exported variables and is rebuilt lazily, once
+ * 			one of them has changed.
+ */
+static char **g_envp = NULL;
+static int g_envp_dirty = 1;
+
+/**
+ * @brief	Entries replaced since the last rebuild. g_envp (and environ)
+ * 			may still point at them, so they are freed on the next one.
+ */
+static char **g_stale = NULL;
+static size_t g_stale_count = 0;
+static size_t g_stale_capacity = 0;
+
+/**
+ * @brief	Exit status of the last pipeline, read back as $?
+ */
+static int g_status = 0;
+
+/**
+ * @brief	This routine checks if name is a valid variable name,
+ * 			looking at no more than len characters.
+ *
+ * @return	1 if it is. Otherwise, 0.
+ */
+int var_is_name(const char *name, size_t len)
+{
+	if (len == 0 || (!isalpha((unsigned char)name[0]) && name[0] != '_')) {
+		return 0;
+	}
+
+	for (size_t i = 1; i < len; i++) {
+		if (!isalnum((unsigned char)name[i]) && name[i] != '_') {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * @brief	This routine lets go of the entry of a variable. Entries
+ * 			that may be part of the environment are kept until it
+ * 			is rebuilt.
+ */
+static void var_retire(var_t *var)
+{
+	if (var->entry == NULL) {
+		return;
+	}
+
+	if (!(var->flags & VAR_EXPORT)) {
+		free(var->entry);
+	} else {
+		if (g_stale_count == g_stale_capacity) {
+			g_stale_capacity = g_stale_capacity ? g_stale_capacity * 2 : 16;
+			g_stale = realloc(g_stale, g_stale_capacity * sizeof(char *));
+			if (g_stale == NULL) {
+				perror("psh");
+				exit(1);
+			}
+		}
+		g_stale[g_stale_count++] = var->entry;
+		g_envp_dirty = 1;
+	}
+
+	var->entry = NULL;
+}
+
+/**
+ * @brief	This routine finds a variable, creating it if needed.
+ *
+ * @return	Variable
+ */
+static var_t *var_find(const char *name, size_t len)
+{
+	if (g_vars == NULL) {
+		g_vars = hashtable_create();
+	}
+
+	char key[len + 1];
+	memcpy(key, name, len);
+	key[len] = '\0';
+
+	var_t *var = hashtable_search(g_vars, key);
+	if (var == NULL) {
+		var = calloc(1, sizeof(var_t));
+		if (var == NULL) {
+			perror("psh");
+			exit(1);
+		}
+		var->name_len = len;
+		hashtable_insert(g_vars, key, var);
+	}
+
+	return var;
+}
+
+/**
+ * @brief	This routine sets a variable from len characters of name
+ * 			and value, adding flags to the ones it already has.
+ *
+ * @return	0 on success, -1 if the name isn't valid.
+ */
+static int var_set_len(const char *name, size_t len, const char *value,
+					   int flags)
+{
+	if (!var_is_name(name, len)) {
+		return -1;
+	}
+
+	var_t *var = var_find(name, len);
+	size_t value_len = strlen(value);
+
+	char *entry = malloc(len + value_len + 2);
+	if (entry == NULL) {
+		perror("psh");
+		exit(1);
+	}
+	memcpy(entry, name, len);
+	entry[len] = '=';
+	memcpy(entry + len + 1, value, value_len + 1);
+
+	var_retire(var);
+	var->entry = entry;
+	var->flags |= flags;
+
+	if (var->flags & VAR_EXPORT) {
+		g_envp_dirty = 1;
+	}
+
+	// the shell searches PATH whether it is exported or not
+	if (len == 4 && strncmp(name, "PATH", 4) == 0) {
+		pathcache_clear();
+	}
+
+	return 0;
+}
+
+/**
+ * @brief	This routine imports an environment, exporting every variable.
+ */
+void var_init(char **envp)
+{
+	for (; envp != NULL && *envp != NULL; envp++) {
+		var_assign(*envp, VAR_EXPORT);
+	}
+}
+
+/**
+ * @brief	This routine looks up the value of a variable.
+ *
+ * @return	Value, or NULL if the variable isn't set.
+ */
+const char *var_get(const char *name)
+{
+	// a special parameter, it can't be set or exported
+	if (name[0] == '?' && name[1] == '\0') {
+		static char status[4];
+		snprintf(status, sizeof(status), "%d", g_status);
+		return status;
+	}
+
+	if (g_vars == NULL) {
+		return NULL;
+	}
+
+	var_t *var = hashtable_search(g_vars, name);
+	if (var == NULL || var->entry == NULL) {
+		return NULL;
+	}
+
+	return var->entry + var->name_len + 1;
+}
+
+/**
+ * @brief	This routine records the exit status of a pipeline for $?.
+ */
+void var_set_status(int status)
+{
+	g_status = status & 0xff;
+}
+
+/**
+ * @brief	This routine reads back the exit status of the last pipeline.
+ *
+ * @return	Value of $?
+ */
+int var_get_status(void)
+{
+	return g_status;
+}
+
+/**
+ * @brief	This routine sets a variable, adding flags to the ones
+ * 			it already has.
+ *
+ * @return	0 on success, -1 if the name isn't valid.
+ */
+int var_set(const char *name, const char *value, int flags)
+{
+	return var_set_len(name, strlen(name), value, flags);
+}
+
+/**
+ * @brief	This routine sets a variable from a NAME=value word.
+ *
+ * @return	0 on success, -1 if the word isn't an assignment.
+ */
+int var_assign(const char *assignment, int flags)
+{
+	const char *value = strchr(assignment, '=');
+	if (value == NULL) {
+		return -1;
+	}
+
+	return var_set_len(assignment, value - assignment, value + 1, flags);
+}
+
+/**
+ * @brief	This routine marks a variable for export. A variable that
+ * 			isn't set yet is exported once it gets a value.
+ *
+ * @return	0 on success, -1 if the name isn't valid.
+ */
+int var_export(const char *name)
+{
+	size_t len = strlen(name);
+	if (!var_is_name(name, len)) {
+		return -1;
+	}
+
+	var_t *var = var_find(name, len);
+	if (!(var->flags & VAR_EXPORT) && var->entry != NULL) {
+		g_envp_dirty = 1;
+	}
+	var->flags |= VAR_EXPORT;
+
+	return 0;
+}
+
+/**
+ * @brief	This routine removes a variable.
+ *
+ * @return	0 on success, -1 if the name isn't valid.
+ */
+int var_unset(const char *name)
+{
+	if (!var_is_name(name, strlen(name))) {
+		return -1;
+	}
+
+	if (g_vars == NULL) {
+		return 0;
+	}
+
+	var_t *var = hashtable_remove(g_vars, name);
+	if (var == NULL) {
+		return 0;
+	}
+
+	var_retire(var);
+	free(var);
+
+	if (strcmp(name, "PATH") == 0) {
+		pathcache_clear();
+	}
+
+	return 0;
+}
+
+/**
+ * @brief	This routine checks if a word has the form NAME=value.
+ *
+ * @return	1 if it does. Otherwise, 0.
+ */
+int var_is_assignment(const char *word)
+{
+	const char *value = strchr(word, '=');
+
+	return value != NULL && var_is_name(word, value - word);
+}
+
+/**
+ * @brief	This routine returns the environment for new commands,
+ * 			rebuilding it if an exported variable changed since the
+ * 			last call. environ is kept pointing at it so libc
+ * 			lookups see the same variables.
+ *
+ * @return	NULL-terminated array of NAME=value strings
+ */
+char **var_environ(void)
+{
+	if (!g_envp_dirty) {
+		return g_envp;
+	}
+
+	size_t count = 0;
+	size_t pos = 0;
+	hashtable_entry_t *entry;
+
+	free(g_envp);
+	g_envp = malloc(((g_vars ? g_vars->count : 0) + 1) * sizeof(char *));
+	if (g_envp == NULL) {
+		perror("psh");
+		exit(1);
+	}
+
+	while (g_vars != NULL && (entry = hashtable_next(g_vars, &pos)) != NULL) {
+		var_t *var = entry->value;
+		if ((var->flags & VAR_EXPORT) && var->entry != NULL) {
+			g_envp[count++] = var->entry;
+		}
+	}
+	g_envp[count] = NULL;
+
+	environ = g_envp;
+	g_envp_dirty = 0;
+
+	for (size_t i = 0; i < g_stale_count; i++) {
+		free(g_stale[i]);
+	}
+	g_stale_count = 0;
+
+	return g_envp;
+}
+
+/**
+ * @brief	This routine prints every variable that has all of flags set,
+ * 			in a form the shell can read back.
+ */
+void var_print(int flags)
+{
+	size_t pos = 0;
+	hashtable_entry_t *entry;
+
+	while (g_vars != NULL && (entry = hashtable_next(g_vars, &pos)) != NULL) {
+		var_t *var = entry->value;
+		if ((var->flags & flags) != flags) {
+			continue;
+		}
+
+		if (flags & VAR_EXPORT) {
+			printf("export ");
+		}
+
+		if (var->entry == NULL) {
+			printf("%s\n", entry->key);
+		} else {
+			printf("%s=\"%s\"\n", entry->key, var->entry + var->name_len + 1);
+		}
+	}
+}
+
+/**
+ * @brief	This routine frees every variable and the environment.
+ */
+void var_clear(void)
+{
+	size_t pos = 0;
+	hashtable_entry_t *entry;
+
+	while (g_vars != NULL && (entry = hashtable_next(g_vars, &pos)) != NULL) {
+		var_t *var = entry->value;
+		free(var->entry);
+		free(var);
+	}
+
+	hashtable_destroy(g_vars);
+	g_vars = NULL;
+
+	for (size_t i = 0; i < g_stale_count; i++) {
+		free(g_stale[i]);
+	}
+	free(g_stale);
+	g_stale = NULL;
+	g_stale_count = 0;
+	g_stale_capacity = 0;
+
+	environ = NULL;
+	free(g_envp);
+	g_envp = NULL;
+	g_envp_dirty = 1;
+}
@@ -0,0 +1,41 @@
+/**
+ * @file:		src/variable.h
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains the routines for
+ * 				shell variables and the environment of commands.
+ */
+
+#ifndef __VARIABLE_H_
+#define __VARIABLE_H_
+
+#include <stddef.h>
+
+#define VAR_EXPORT (1 << 0)
+
+/**
+ * @brief	A shell variable. entry holds "NAME=value" so the environment
+ * 			can point straight at it, and is NULL while the variable is
+ * 			exported but has no value yet.
+ */
+typedef struct {
+	char *entry;
+	size_t name_len;
+	int flags;
+} var_t;
+
+void var_init(char **envp);
+const char *var_get(const char *name);
+int var_set(const char *name, const char *value, int flags);
+void var_set_status(int status);
+int var_get_status(void);
+int var_assign(const char *assignment, int flags);
+int var_export(const char *name);
+int var_unset(const char *name);
+int var_is_name(const char *name, size_t len);
+int var_is_assignment(const char *word);
+char **var_environ(void);
+void var_print(int flags);
+void var_clear(void);
+
+#endif // __VARIABLE_H_
@@ -0,0 +1,698 @@
+/**
+ * @file:		src/wildcard.c
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains the routines for
+ * 				matching patterns and expanding them to paths.
+ *
+ * 				Directories are read with getdents64() into sorted
+ * 				listings that are kept until the directory's mtime
+ * 				changes, so several patterns over one huge directory
+ * 				only read it once.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "hashtable.h"
+#include "wildcard.h"
+
+static hashtable_t *g_dirs = NULL;
+static size_t g_names = 0;
+
+/**
+ * @brief	State of one expansion. path holds the directory being
+ * 			walked, matches are appended to argv.
+ */
+typedef struct {
+	arena_t *arena;
+	char ***argv;
+	int *pos;
+	int *size;
+	int matches;
+	char path[PATH_MAX];
+} wildcard_walk_t;
+
+/**
+ * @brief	Character classes that may appear as [:name:] in brackets
+ */
+static const struct {
+	const char *name;
+	int (*func)(int c);
+} g_classes[] = {
+	{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+	{ "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+	{ "lower", islower }, { "print", isprint }, { "punct", ispunct },
+	{ "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+};
+
+/**
+ * @brief	This routine checks c against the [:name:] class at p.
+ *
+ * @return	Position after the class, or NULL if p doesn't start one.
+ */
+static const char *wildcard_named_class(const char *p, unsigned char c,
+										int *matched)
+{
+	const char *end = strstr(p + 2, ":]");
+	if (end == NULL) {
+		return NULL;
+	}
+
+	size_t len = end - (p + 2);
+	for (size_t i = 0; i < sizeof(g_classes) / sizeof(g_classes[0]); i++) {
+		if (strlen(g_classes[i].name) == len &&
+			strncmp(g_classes[i].name, p + 2, len) == 0) {
+			*matched |= g_classes[i].func(c) != 0;
+			return end + 2;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief	This routine checks c against the bracket expression at p.
+ * 			A leading '!' or '^' negates it, a ']' right after the
+ * 			opening bracket is taken literally.
+ *
+ * @return	Position after the closing bracket, or NULL if it is never
+ * 			closed and the '[' is just a character.
+ */
+static const char *wildcard_class(const char *p, unsigned char c,
+								  int *matched)
+{
+	const char *q = p + 1;
+	int negate = *q == '!' || *q == '^';
+	if (negate) {
+		q++;
+	}
+
+	*matched = 0;
+	for (int first = 1; *q != ']' || first; first = 0) {
+		if (*q == '\0') {
+			return NULL;
+		}
+
+		if (q[0] == '[' && q[1] == ':') {
+			const char *end = wildcard_named_class(q, c, matched);
+			if (end != NULL) {
+				q = end;
+				continue;
+			}
+		}
+
+		unsigned char low = *q;
+		if (low == '\\' && q[1] != '\0') {
+			low = *++q;
+		}
+		q++;
+
+		if (q[0] == '-' && q[1] != ']' && q[1] != '\0') {
+			unsigned char high = q[1];
+			if (high == '\\' && q[2] != '\0') {
+				high = *++q;
+			}
+			q += 2;
+			*matched |= c >= low && c <= high;
+		} else {
+			*matched |= c == low;
+		}
+	}
+
+	*matched ^= negate;
+	return q + 1;
+}
+
+/**
+ * @brief	This routine matches a single character against the
+ * 			pattern element at p.
+ *
+ * @return	Position of the next element if it matches. Otherwise, NULL.
+ */
+static const char *wildcard_match_char(const char *p, unsigned char c)
+{
+	if (*p == '?') {
+		return p + 1;
+	}
+
+	if (*p == '[') {
+		int matched;
+		const char *end = wildcard_class(p, c, &matched);
+		if (end != NULL) {
+			return matched ? end : NULL;
+		}
+	} else if (*p == '\\' && p[1] != '\0') {
+		p++;
+	}
+
+	return (unsigned char)*p == c ? p + 1 : NULL;
+}
+
+/**
+ * @brief	This routine matches a whole string against a pattern of
+ * 			'*', '?', bracket expressions and backslash escapes.
+ * 			A failed match backs up to the last '*' only, so it
+ * 			takes linear time for all but pathological patterns.
+ *
+ * @return	1 if it matches. Otherwise, 0.
+ */
+int wildcard_match(const char *pattern, const char *string)
+{
+	const char *star = NULL;
+	const char *resume = NULL;
+
+	while (*string != '\0') {
+		if (*pattern == '*') {
+			star = ++pattern;
+			resume = string;
+			continue;
+		}
+
+		const char *next = wildcard_match_char(pattern, *string);
+		if (next != NULL && *pattern != '\0') {
+			pattern = next;
+			string++;
+		} else if (star != NULL) {
+			// let the last '*' take one more character
+			pattern = star;
+			string = ++resume;
+		} else {
+			return 0;
+		}
+	}
+
+	while (*pattern == '*') {
+		pattern++;
+	}
+
+	return *pattern == '\0';
+}
+
+/**
+ * @brief	This routine checks if len characters of a pattern need
+ * 			matching against a directory, rather than naming a path.
+ *
+ * @return	1 if they do. Otherwise, 0.
+ */
+static int wildcard_is_magic(const char *pattern, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		if (pattern[i] == '\\') {
+			i++;
+		} else if (pattern[i] == '*' || pattern[i] == '?' ||
+				   pattern[i] == '[') {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief	This routine orders listing entries by name.
+ */
+static int wildcard_compare_entries(const void *a, const void *b)
+{
+	return strcmp(((const wildcard_entry_t *)a)->name,
+				  ((const wildcard_entry_t *)b)->name);
+}
+
+/**
+ * @brief	This routine orders paths in argv.
+ */
+static int wildcard_compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief	This routine frees a directory listing.
+ */
+static void wildcard_free_dir(wildcard_dir_t *dir)
+{
+	free(dir->entries);
+	free(dir->dents);
+	free(dir);
+}
+
+/**
+ * @brief	This routine checks if a directory with mtime could still
+ * 			change without it moving, because the clock file times come
+ * 			from hasn't left that tick yet. Times without nanoseconds
+ * 			are taken to be whole seconds.
+ *
+ * @return	1 if it could. Otherwise, 0.
+ */
+static int wildcard_is_racy(const struct timespec *now,
+							const struct timespec *mtime)
+{
+	if (mtime->tv_nsec == 0) {
+		return now->tv_sec <= mtime->tv_sec;
+	}
+
+	return now->tv_sec < mtime->tv_sec ||
+		   (now->tv_sec == mtime->tv_sec && now->tv_nsec <= mtime->tv_nsec);
+}
+
+/**
+ * @brief	This routine reads a directory, which st describes, with
+ * 			getdents64() and sorts its names.
+ *
+ * @return	New listing, or NULL if it can't be read.
+ */
+static wildcard_dir_t *wildcard_read(const char *name, const struct stat *st)
+{
+	// the kernel stamps files with the coarse clock; anything changed
+	// after this gets a later mtime unless it is still in its tick
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
+	int fd = open(name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	size_t capacity = WILDCARD_DENTS_SIZE;
+	size_t used = 0;
+	char *dents = malloc(capacity);
+	if (dents == NULL) {
+		perror("psh");
+		exit(1);
+	}
+
+	for (;;) {
+		// getdents64() wants room for a whole record
+		if (capacity - used < WILDCARD_DENTS_SIZE / 2) {
+			capacity *= 2;
+			dents = realloc(dents, capacity);
+			if (dents == NULL) {
+				perror("psh");
+				exit(1);
+			}
+		}
+
+		ssize_t len = getdents64(fd, dents + used, capacity - used);
+		if (len < 0 && errno == EINTR) {
+			continue;
+		}
+		if (len < 0) {
+			close(fd);
+			free(dents);
+			return NULL;
+		}
+		if (len == 0) {
+			break;
+		}
+		used += len;
+	}
+	close(fd);
+
+	wildcard_dir_t *dir = calloc(1, sizeof(wildcard_dir_t));
+	if (dir == NULL) {
+		perror("psh");
+		exit(1);
+	}
+	dir->dents = dents;
+
+	size_t count = 0;
+	for (size_t off = 0; off < used;
+		 off += ((struct dirent64 *)(dents + off))->d_reclen) {
+		count++;
+	}
+
+	dir->entries = malloc((count ? count : 1) * sizeof(wildcard_entry_t));
+	if (dir->entries == NULL) {
+		perror("psh");
+		exit(1);
+	}
+
+	for (size_t off = 0; off < used;
+		 off += ((struct dirent64 *)(dents + off))->d_reclen) {
+		struct dirent64 *record = (struct dirent64 *)(dents + off);
+		const char *entry = record->d_name;
+		if (strcmp(entry, ".") == 0 || strcmp(entry, "..") == 0) {
+			continue;
+		}
+		dir->entries[dir->count].name = entry;
+		dir->entries[dir->count].type = record->d_type;
+		dir->count++;
+	}
+
+	qsort(dir->entries, dir->count, sizeof(wildcard_entry_t),
+		  wildcard_compare_entries);
+
+	dir->dev = st->st_dev;
+	dir->ino = st->st_ino;
+	dir->mtime = st->st_mtim;
+	dir->racy = wildcard_is_racy(&now, &st->st_mtim);
+
+	return dir;
+}
+
+/**
+ * @brief	This routine finds the listing of the directory path names,
+ * 			reading it again if it changed since it was cached. Once
+ * 			the cache is full, listings are only lent to the caller.
+ *
+ * @return	Listing to pass to wildcard_release(), or NULL if path
+ * 			isn't a readable directory.
+ */
+static wildcard_dir_t *wildcard_list(const char *path)
+{
+	const char *name = *path != '\0' ? path : ".";
+	struct stat st;
+
+	if (stat(name, &st) < 0 || !S_ISDIR(st.st_mode)) {
+		return NULL;
+	}
+
+	wildcard_dir_t *dir = NULL;
+	if (g_dirs != NULL) {
+		dir = hashtable_search(g_dirs, name);
+	}
+
+	if (dir != NULL && !dir->racy && dir->dev == st.st_dev &&
+		dir->ino == st.st_ino && dir->mtime.tv_sec == st.st_mtim.tv_sec &&
+		dir->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+		return dir;
+	}
+
+	wildcard_dir_t *fresh = wildcard_read(name, &st);
+	if (fresh == NULL) {
+		return NULL;
+	}
+
+	if (dir != NULL) {
+		g_names -= dir->count;
+		wildcard_free_dir(dir);
+	} else if (g_dirs == NULL) {
+		g_dirs = hashtable_create();
+	} else if (g_dirs->count >= WILDCARD_MAX_DIRS ||
+			   g_names + fresh->count > WILDCARD_MAX_NAMES) {
+		return fresh;
+	}
+
+	fresh->cached = 1;
+	g_names += fresh->count;
+	hashtable_insert(g_dirs, name, fresh);
+
+	return fresh;
+}
+
+/**
+ * @brief	This routine gives back a listing from wildcard_list().
+ */
+static void wildcard_release(wildcard_dir_t *dir)
+{
+	if (!dir->cached) {
+		wildcard_free_dir(dir);
+	}
+}
+
+/**
+ * @brief	This routine checks if the entry at path is a directory.
+ * 			Symbolic links are only followed with follow set.
+ *
+ * @return	1 if it is. Otherwise, 0.
+ */
+static int wildcard_is_dir(const char *path, const wildcard_entry_t *entry,
+						   int follow)
+{
+	struct stat st;
+
+	if (entry->type == DT_DIR) {
+		return 1;
+	}
+
+	if (entry->type == DT_UNKNOWN) {
+		return (follow ? stat(path, &st) : lstat(path, &st)) == 0 &&
+			   S_ISDIR(st.st_mode);
+	}
+
+	if (entry->type == DT_LNK && follow) {
+		return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief	This routine appends the first len characters of the walked
+ * 			path to argv, doubling argv when it is full.
+ */
+static void wildcard_push(wildcard_walk_t *w, size_t len)
+{
+	// keep a slot free for the terminating NULL
+	if (*w->pos + 2 >= *w->size) {
+		*w->argv = arena_realloc(w->arena, *w->argv, *w->size * sizeof(char *),
+								 2 * *w->size * sizeof(char *));
+		*w->size *= 2;
+	}
+
+	(*w->argv)[(*w->pos)++] = arena_strndup(w->arena, w->path, len);
+	w->matches++;
+}
+
+static void wildcard_walk(wildcard_walk_t *w, size_t len, const char *pattern);
+
+/**
+ * @brief	This routine matches '**', any number of directories below
+ * 			the walked one, followed by rest. Without rest it matches
+ * 			everything below it. Hidden directories and links to
+ * 			directories aren't entered.
+ */
+static void wildcard_globstar(wildcard_walk_t *w, size_t len,
+							  const char *rest)
+{
+	if (rest != NULL) {
+		wildcard_walk(w, len, rest);
+	}
+
+	wildcard_dir_t *dir = wildcard_list(w->path);
+	if (dir == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < dir->count; i++) {
+		const wildcard_entry_t *entry = &dir->entries[i];
+		size_t name_len = strlen(entry->name);
+
+		if (entry->name[0] == '.' || len + name_len + 2 >= PATH_MAX) {
+			continue;
+		}
+
+		memcpy(w->path + len, entry->name, name_len + 1);
+		if (rest == NULL) {
+			wildcard_push(w, len + name_len);
+		}
+		if (wildcard_is_dir(w->path, entry, 0)) {
+			w->path[len + name_len] = '/';
+			w->path[len + name_len + 1] = '\0';
+			wildcard_globstar(w, len + name_len + 1, rest);
+		} else if (rest != NULL && *rest == '\0' &&
+				   wildcard_is_dir(w->path, entry, 1)) {
+			// '**/' still names a link to a directory, without entering it
+			w->path[len + name_len] = '/';
+			wildcard_push(w, len + name_len + 1);
+		}
+	}
+
+	w->path[len] = '\0';
+	wildcard_release(dir);
+}
+
+/**
+ * @brief	This routine matches the rest of a pattern below the walked
+ * 			directory, one component at a time. Components without
+ * 			special characters are taken as they are, the others are
+ * 			matched against the directory's listing.
+ */
+static void wildcard_walk(wildcard_walk_t *w, size_t len, const char *pattern)
+{
+	// a trailing slash, only directories got here
+	if (*pattern == '\0') {
+		if (len > 0) {
+			wildcard_push(w, len);
+		}
+		return;
+	}
+
+	const char *slash = strchr(pattern, '/');
+	size_t pattern_len = slash != NULL ? (size_t)(slash - pattern)
+									   : strlen(pattern);
+
+	if (pattern_len == 2 && pattern[0] == '*' && pattern[1] == '*') {
+		// a final '**' matches the directory it starts from too
+		if (slash == NULL && len > 0) {
+			wildcard_push(w, len);
+		}
+		wildcard_globstar(w, len, slash != NULL ? slash + 1 : NULL);
+		return;
+	}
+
+	if (!wildcard_is_magic(pattern, pattern_len)) {
+		size_t end = len;
+		for (size_t i = 0; i < pattern_len; i++) {
+			char c = pattern[i];
+			if (c == '\\' && i + 1 < pattern_len) {
+				c = pattern[++i];
+			}
+			if (end + 2 >= PATH_MAX) {
+				return;
+			}
+			w->path[end++] = c;
+		}
+		w->path[end] = '\0';
+
+		if (slash == NULL) {
+			struct stat st;
+			if (lstat(w->path, &st) == 0) {
+				wildcard_push(w, end);
+			}
+		} else {
+			w->path[end++] = '/';
+			w->path[end] = '\0';
+			wildcard_walk(w, end, slash + 1);
+		}
+		w->path[len] = '\0';
+		return;
+	}
+
+	char component[pattern_len + 1];
+	memcpy(component, pattern, pattern_len);
+	component[pattern_len] = '\0';
+
+	// hidden names only match a pattern that starts with a dot
+	int dotted = component[0] == '.' ||
+				 (component[0] == '\\' && component[1] == '.');
+
+	wildcard_dir_t *dir = wildcard_list(w->path);
+	if (dir == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < dir->count; i++) {
+		const wildcard_entry_t *entry = &dir->entries[i];
+
+		if ((entry->name[0] == '.' && !dotted) ||
+			!wildcard_match(component, entry->name)) {
+			continue;
+		}
+
+		size_t name_len = strlen(entry->name);
+		if (len + name_len + 2 >= PATH_MAX) {
+			continue;
+		}
+		memcpy(w->path + len, entry->name, name_len + 1);
+
+		if (slash == NULL) {
+			wildcard_push(w, len + name_len);
+		} else if (wildcard_is_dir(w->path, entry, 1)) {
+			w->path[len + name_len] = '/';
+			w->path[len + name_len + 1] = '\0';
+			wildcard_walk(w, len + name_len + 1, slash + 1);
+		}
+	}
+
+	w->path[len] = '\0';
+	wildcard_release(dir);
+}
+
+/**
+ * @brief	This routine checks if matches of a pattern come from more
+ * 			than one directory, and so aren't sorted already.
+ *
+ * @return	1 if they do. Otherwise, 0.
+ */
+static int wildcard_is_deep(const char *pattern)
+{
+	int magic = 0;
+
+	for (;;) {
+		const char *slash = strchr(pattern, '/');
+		size_t len = slash != NULL ? (size_t)(slash - pattern)
+								   : strlen(pattern);
+
+		if (wildcard_is_magic(pattern, len) && ++magic > 1) {
+			return 1;
+		}
+		if (len == 2 && pattern[0] == '*' && pattern[1] == '*') {
+			return 1;
+		}
+
+		if (slash == NULL) {
+			return 0;
+		}
+		pattern = slash + 1;
+	}
+}
+
+/**
+ * @brief	This routine appends the paths matching a pattern to argv,
+ * 			sorted, growing it geometrically. A component of '**'
+ * 			matches any number of directories.
+ *
+ * @return	Number of paths appended, 0 if nothing matched.
+ */
+int wildcard_expand(arena_t *arena, const char *pattern, char ***argv,
+					int *pos, int *size)
+{
+	// the listings in use by the walk must stay, so only start over here
+	if (g_dirs != NULL && (g_dirs->count >= WILDCARD_MAX_DIRS ||
+						   g_names >= WILDCARD_MAX_NAMES)) {
+		wildcard_clear();
+	}
+
+	wildcard_walk_t w;
+	w.arena = arena;
+	w.argv = argv;
+	w.pos = pos;
+	w.size = size;
+	w.matches = 0;
+
+	int first = *pos;
+	if (pattern[0] == '/') {
+		strcpy(w.path, "/");
+		wildcard_walk(&w, 1, pattern + 1);
+	} else {
+		w.path[0] = '\0';
+		wildcard_walk(&w, 0, pattern);
+	}
+
+	// a single listing is sorted already
+	if (w.matches > 1 && wildcard_is_deep(pattern)) {
+		qsort(*argv + first, w.matches, sizeof(char *),
+			  wildcard_compare_paths);
+	}
+
+	return w.matches;
+}
+
+/**
+ * @brief	This routine forgets every cached directory listing.
+ */
+void wildcard_clear(void)
+{
+	if (g_dirs == NULL) {
+		return;
+	}
+
+	size_t pos = 0;
+	hashtable_entry_t *entry;
+	while ((entry = hashtable_next(g_dirs, &pos)) != NULL) {
+		wildcard_free_dir(entry->value);
+	}
+
+	hashtable_destroy(g_dirs);
+	g_dirs = NULL;
+	g_names = 0;
+}
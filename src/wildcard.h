@@ -0,0 +1,58 @@
+/**
+ * @file:		src/wildcard.h
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file contains the routines for
+ * 				matching patterns and expanding them to paths.
+ */
+
+#ifndef __WILDCARD_H_
+#define __WILDCARD_H_
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "arena.h"
+
+/**
+ * @brief	Initial size of the buffer a directory is read into
+ */
+#define WILDCARD_DENTS_SIZE 65536
+
+/**
+ * @brief	Number of cached directories, and of names in all of them,
+ * 			after which the cache starts over
+ */
+#define WILDCARD_MAX_DIRS 256
+#define WILDCARD_MAX_NAMES (1 << 20)
+
+typedef struct {
+	const char *name;
+	unsigned char type;
+} wildcard_entry_t;
+
+/**
+ * @brief	Sorted listing of a directory, without "." and "..". The
+ * 			names point into the records getdents64() filled dents
+ * 			with. It is valid as long as the directory keeps its
+ * 			inode and mtime, unless it is racy: read in the same
+ * 			timestamp tick it was changed in, so it is read once more.
+ */
+typedef struct {
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	int racy;
+	int cached;
+	char *dents;
+	wildcard_entry_t *entries;
+	size_t count;
+} wildcard_dir_t;
+
+int wildcard_match(const char *pattern, const char *string);
+int wildcard_expand(arena_t *arena, const char *pattern, char ***argv,
+					int *pos, int *size);
+void wildcard_clear(void);
+
+#endif // __WILDCARD_H_
@@ -0,0 +1,463 @@
+#!/bin/sh
+#
+# Copyright (c) 2023-2024 Jozef Nagy
+#
+# Use of this source code is governed by an MIT-style
+# license that can be found in the LICENSE file or at
+# https://opensource.org/licenses/MIT.
+#
+# Runs regression scripts under psh and compares their output.
+#
+#	check.sh [shell]
+#
+# Every script runs with stdin from /dev/null and a timeout, so a
+# shell that hangs fails the check instead of stalling it.
+#
+
+psh=${1:-./psh}
+# the scripts run in a scratch directory
+case $psh in
+/*) ;;
+*/*) psh=$PWD/$psh ;;
+esac
+timeout=10
+failed=0
+count=0
+
+# for scripts that start another psh
+PSH=$psh
+export PSH
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# check name script expected
+check()
+{
+	count=$((count + 1))
+	printf '%s\n' "$2" >"$dir/script"
+	printf '%s\n' "$3" >"$dir/expected"
+
+	(cd "$dir" && timeout $timeout "$psh" script </dev/null >output 2>&1)
+	status=$?
+
+	if [ $status -eq 124 ]; then
+		echo "FAIL $1: timed out"
+		failed=$((failed + 1))
+	elif ! cmp -s "$dir/expected" "$dir/output"; then
+		echo "FAIL $1:"
+		diff "$dir/expected" "$dir/output"
+		failed=$((failed + 1))
+	fi
+}
+
+check pipe_reader_exits 'seq 1 1000000 | head -1' '1'
+
+check pipe_reader_exits_middle 'seq 1 1000000 | cat | head -1' '1'
+
+check redirect_open_fails 'echo x >/nonexistent/x
+echo $?' '/nonexistent/x: No such file or directory
+1'
+
+check parallel_word_spaces "parallel sh -c 'exit {}' ::: 0 1 2
+echo \$?" 'parallel: 1: exit 1
+parallel: 2: exit 2
+2'
+
+check parallel_word_semicolon "parallel sh -c 'echo x{}x; exit 1' ::: a
+echo \$?" 'xax
+parallel: a: exit 1
+1'
+
+check parallel_word_quotes "parallel echo \"it's\" '\"q\"' '{}  {}' ::: 'x;y'" \
+	'it'"'"'s "q" x;y  x;y'
+
+check stdin_script 'printf "read x\nhello\necho \$x\nhead -1\nline\necho end\n" >in
+$PSH <in' 'hello
+line
+end'
+
+check cat_input_is_output 'echo abc >f
+cat f >>f
+echo $?
+cat f - <f >>f
+cat f
+cat f >f
+cat f
+echo $?' 'cat: f: input file is output file
+1
+cat: f: input file is output file
+cat: -: input file is output file
+abc
+0'
+
+check piped_script 'printf "read x\nthis is data\necho \"x=\$x\"\necho end" | $PSH' \
+	'x=this is data
+end'
+
+check long_compound 'echo "if true; then" >long
+seq 1 20000 | sed "s/^/x=/" >>long
+echo fi >>long
+echo "echo \$x" >>long
+$PSH long' '20000'
+
+check job_notices_quiet 'true &
+sleep 0.1
+echo done' 'done'
+
+check wait_exited_any 'sh -c "exit 3" &
+sleep 0.2
+wait -n
+echo $?' '3'
+
+check wait_exited_spec 'sh -c "exit 3" &
+sh -c "exit 4" &
+sleep 0.2
+wait %2
+echo $?
+wait %1
+echo $?' '4
+3'
+
+check wait_exited_all 'sh -c "exit 3" &
+sleep 0.2
+wait
+echo $?
+wait %1
+echo $?' '0
+wait: %1: no such job
+127'
+
+check parallel_slow_first "sh -c 'ulimit -n 24; exec \"\$PSH\" -s' <<'END'
+parallel -j 2 sh -c 'case \$0 in 1) sleep 0.5;; esac; echo \$0' ::: \$(seq 1 60) | tail -n 2
+END" '59
+60'
+
+check command_subst 'echo "[$(echo a)]"
+echo "[$(printf "a\n\n\n")]"
+echo "[$(echo $(echo nested))]"
+echo "[`echo back`]"
+x=$(false)
+echo $?
+x=$(sh -c "exit 5")
+echo $?
+for w in $(echo one two); do echo "<$w>"; done
+echo "<$(echo one two)>"
+echo $(seq 1 3 | tr "\n" " ")
+echo "$(echo first; echo second)"' '[a]
+[a]
+[nested]
+[back]
+1
+5
+<one>
+<two>
+<one two>
+1 2 3
+first
+second'
+
+check subst_syntax_error 'echo "a$(if)b"
+echo $?' 'psh: syntax error: unexpected end of line
+2'
+
+check subst_syntax_error_assign 'x=$(fi) && echo set
+echo $?' 'psh: syntax error near unexpected token `fi'"'"'
+2'
+
+check subst_syntax_error_for 'for i in 1 $(done); do echo $i; done
+echo $?' 'psh: syntax error near unexpected token `done'"'"'
+2'
+
+check process_subst 'cat <(echo in)
+diff <(printf "a\nb\n") <(printf "a\nc\n") | grep "^[<>]"
+paste <(seq 1 3) <(seq 4 6)
+echo out | tee >(cat >psub.txt) >/dev/null
+sleep 0.2
+cat psub.txt
+cat <(cat <(echo nested))
+wc -l < <(seq 1 5)' 'in
+< b
+> c
+1	4
+2	5
+3	6
+out
+nested
+5'
+
+check psubst_syntax_error 'cat <(if)
+echo $?' 'psh: syntax error: unexpected end of line
+2'
+
+check glob_patterns 'mkdir -p g/sub1 g/sub2
+touch g/a.c g/b.c g/c.h g/.hidden g/ab g/sub1/x g/sub2/x "g/sp ace"
+echo g/*.c
+echo g/?.h
+echo g/[ab]*
+echo g/[!ab]*
+echo g/.*
+echo g/*/x
+echo g/nomatch*
+echo "g/*.c"
+echo g/\*.c
+for f in g/sp*; do echo "<$f>"; done
+case g/a.c in g/*.c) echo matched ;; esac' 'g/a.c g/b.c
+g/c.h
+g/a.c g/ab g/b.c
+g/c.h g/sp ace g/sub1 g/sub2
+g/.hidden
+g/sub1/x g/sub2/x
+g/nomatch*
+g/*.c
+g/*.c
+<g/sp ace>
+matched'
+
+check glob_new_files 'mkdir d
+for i in 1 2 3 4; do echo >d/f$i; echo d/f*; done' 'd/f1
+d/f1 d/f2
+d/f1 d/f2 d/f3
+d/f1 d/f2 d/f3 d/f4'
+
+check path_cache 'mkdir bin
+printf "#!/bin/sh\necho one\n" >bin/tool
+chmod +x bin/tool
+tool
+echo $?
+PATH=$PWD/bin:$PATH
+tool
+tool
+hash | cut -f1
+hash -r
+hash
+hash tool
+hash | cut -f1
+hash nonexistent
+echo $?' 'psh: tool: command not found
+127
+one
+one
+hits
+   2
+hash: hash table empty
+hits
+   0
+hash: nonexistent: not found
+1'
+
+check job_table_grows 'for i in $(seq 1 100); do sleep 0.5 & done
+jobs >list
+wc -l <list
+tail -n 1 list | cut -f 1,3-
+wait
+echo $?
+jobs' '100
+[100]	running	sleep 0.5
+0'
+
+check parse_cache_repeats 'mkdir cached
+x=1
+echo "x=$x $(echo sub$x)" >out
+cat out
+x=2
+echo "x=$x $(echo sub$x)" >out
+cat out
+touch cached/a
+echo cached/*
+touch cached/b
+echo cached/*
+sleep 0.2 &
+sleep 0.2 &
+jobs >list
+cut -f 1,3- list
+wait' 'x=1 sub1
+x=2 sub2
+cached/a
+cached/a cached/b
+[1]	running	sleep 0.2
+[2]	running	sleep 0.2'
+
+check variables_export 'x=1
+echo "$x"
+printenv x || echo none
+export x
+printenv x
+x=2
+printenv x
+unset x
+echo "[$x]"
+printenv x || echo none
+export y=3
+env | grep "^y="' '1
+none
+1
+2
+[]
+none
+y=3'
+
+check time_report 'printf "time sleep 0.1\ntime false\necho \$?\ntime true | sh -c \"exit 3\"\necho \$?\n" >timed.sh
+sh -c "\"\$PSH\" timed.sh 2>&1" >report
+awk "\$NF == \"0.1\" && \$1 + 0 >= 0.1 { print \"slept\" }" report
+awk "NF < 7 { print; next } { print \$1 ~ /s\$/, \$4 ~ /k\$/, \$7 }" report' 'slept
+0 0 command
+1 1 sleep
+1 1 total
+0 0 command
+1 1 false
+1 1 total
+1
+0 0 command
+1 1 true
+1 1 sh
+1 1 total
+3'
+
+check builtin_printf 'printf "%s-%d|%5s|%-3s|%x|%%\n" a 42 right l 255
+printf "%s\n" one two three
+printf "no newline"
+echo
+printf "%b\n" "a\tb"' 'a-42|right|l  |ff|%
+one
+two
+three
+no newline
+a	b'
+
+check builtin_test 'test 1 -lt 2 && echo lt
+[ abc = abc ] && echo eq
+[ -n "" ] || echo empty
+[ ! -e /nonexistent ] && echo missing
+[ -d . -a -f script ] && echo and
+[ 1 -eq 2 -o 2 -eq 2 ] && echo or
+[ 1 -gt ]
+echo $?' 'test: -gt: unexpected operator
+lt
+eq
+empty
+missing
+and
+or
+2'
+
+check builtin_read_pwd_type 'read a b <<EOF
+first second third
+EOF
+echo "$a|$b"
+mkdir -p sub
+cd sub
+pwd | sed "s|.*/||"
+cd ..
+type echo
+type cd
+type sh | sed "s| is .*| is a file|"
+type nosuchcmd
+echo $?' 'first|second third
+sub
+echo is a shell builtin
+cd is a shell builtin
+sh is a file
+type: nosuchcmd: not found
+1'
+
+check and_or_lists 'echo a; echo b
+true && echo and
+false && echo skipped
+false || echo or
+true || echo skipped
+false && echo no || echo fallback
+true && false || echo chain
+false; echo $?
+true && sh -c "exit 4"; echo $?
+false || false || echo last
+echo x >f && cat f' 'a
+b
+and
+or
+fallback
+chain
+1
+4
+last
+x'
+
+check control_flow 'for i in 1 2 3; do
+	if [ $i = 2 ]; then
+		echo two
+	elif [ $i = 3 ]; then
+		echo three
+	else
+		echo other
+	fi
+done
+n=
+while [ "$n" != xxx ]; do n=x$n; done
+echo $n
+until true; do echo never; done
+for i in a b c; do
+	for j in 1 2 3; do
+		[ $j = 2 ] && continue
+		[ $i = b ] && break 2
+		echo $i$j
+	done
+done
+case foo.c in
+*.h) echo header ;;
+*.c | *.cc) echo source ;;
+*) echo other ;;
+esac
+case x in y) echo no ;; esac
+echo $?
+if false; then :; fi
+echo $?
+for w in one "two three"; do echo "[$w]"; done' 'other
+two
+three
+xxx
+a1
+a3
+source
+0
+0
+[one]
+[two three]'
+
+check here_documents 'x=value
+cat <<EOF
+plain $x
+$(echo subst)
+EOF
+cat <<'"'"'EOF'"'"'
+quoted $x
+EOF
+cat <<-EOF
+	stripped
+		once
+	EOF
+cat <<EOF | tr a-z A-Z
+piped
+EOF
+while read line; do echo "<$line>"; done <<EOF
+one
+two
+EOF
+cat <<<"here string $x"
+read y <<<word
+echo $y
+cat <<EOF
+EOF
+echo empty $?' 'plain value
+subst
+quoted $x
+stripped
+once
+PIPED
+<one>
+<two>
+here string value
+word
+empty 0'
+
+echo "$((count - failed))/$count passed"
+[ $failed -eq 0 ]
@@ -0,0 +1,112 @@
+/**
+ * @file:		tools/mkbuiltin.c
+ * @author:		Jozef Nagy <schkwve@gmail.com>
+ * @copyright:	MIT (See LICENSE.md)
+ * @brief:		This file generates src/builtin_table.h, a perfect
+ * 				hash table of the commands in src/builtin.def.
+ *
+ * 				The table is the smallest power of two for which some
+ * 				seed of builtin_hash() maps every name to its own slot,
+ * 				so a lookup is one hash and one string compare.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "builtin.h"
+
+/**
+ * @brief	Seeds tried per table size before doubling it
+ */
+#define MKBUILTIN_MAX_SEEDS 1000000
+
+static const struct {
+	const char *name;
+	const char *func;
+	const char *flags;
+} g_defs[] = {
+#define BUILTIN(name, func, flags) { name, #func, #flags },
+#include "builtin.def"
+#undef BUILTIN
+};
+
+#define DEF_COUNT (sizeof(g_defs) / sizeof(g_defs[0]))
+
+/**
+ * @brief	This routine places every name into slots using seed.
+ *
+ * @return	1 if no two names collide. Otherwise, 0.
+ */
+static int mkbuiltin_try(uint32_t seed, size_t size, int *slots)
+{
+	for (size_t i = 0; i < size; i++) {
+		slots[i] = -1;
+	}
+
+	for (size_t i = 0; i < DEF_COUNT; i++) {
+		size_t slot = builtin_hash(g_defs[i].name, seed) & (size - 1);
+		if (slots[slot] >= 0) {
+			return 0;
+		}
+		slots[slot] = i;
+	}
+
+	return 1;
+}
+
+/**
+ * @brief	Main entry point
+ */
+int main(void)
+{
+	size_t size = 1;
+	while (size < DEF_COUNT) {
+		size *= 2;
+	}
+
+	int *slots = NULL;
+	uint32_t seed = 0;
+	for (;;) {
+		slots = realloc(slots, size * sizeof(int));
+
+		for (seed = 1; seed <= MKBUILTIN_MAX_SEEDS; seed++) {
+			if (mkbuiltin_try(seed, size, slots)) {
+				break;
+			}
+		}
+
+		if (seed <= MKBUILTIN_MAX_SEEDS) {
+			break;
+		}
+		size *= 2;
+	}
+
+	printf("/**\n"
+		   " * @file:\t\tsrc/builtin_table.h\n"
+		   " * @brief:\t\tThis file is generated by tools/mkbuiltin from\n"
+		   " * \t\t\t\tsrc/builtin.def. Do not edit.\n"
+		   " */\n\n"
+		   "#ifndef __BUILTIN_TABLE_H_\n"
+		   "#define __BUILTIN_TABLE_H_\n\n"
+		   "#include \"builtin.h\"\n\n"
+		   "#define BUILTIN_HASH_SEED %uu\n"
+		   "#define BUILTIN_TABLE_SIZE %zu\n\n"
+		   "static const builtin_t g_builtin_table[BUILTIN_TABLE_SIZE] = {\n",
+		   seed, size);
+
+	for (size_t i = 0; i < size; i++) {
+		if (slots[i] >= 0) {
+			printf("\t[%zu] = { \"%s\", %s, %s },\n", i,
+				   g_defs[slots[i]].name, g_defs[slots[i]].func,
+				   g_defs[slots[i]].flags);
+		}
+	}
+
+	printf("};\n\n"
+		   "#endif // __BUILTIN_TABLE_H_\n");
+
+	free(slots);
+	return 0;
+}